@@ -6,12 +6,40 @@ Assignment: ex6
 
 #include "ex6.h"
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 
 # define INT_BUFFER 128
 
+#ifdef EX6_ALLOC_PROFILE
+// Every allocation in this file goes through the profiler
+#define malloc(size) profMalloc((size), __FILE__, __LINE__)
+#define calloc(count, size) profCalloc((count), (size), __FILE__, __LINE__)
+#define realloc(ptr, size) profRealloc((ptr), (size), __FILE__, __LINE__)
+#define free(ptr) profFree(ptr)
+#endif
+
+// Operation names of the menu choices, for the allocation profiler
+static const char* mainMenuOps[] = {"menu", "open", "enter", "delete", "merge", "sort",
+                                    "print", "exit", "stats", "validate", "mergemany", "query", "export", "typestats",
+                                    "compare", "trade"};
+static const char* pokedexMenuOps[] = {"menu", "add", "display", "release", "fight", "evolve", "back",
+                                       "evolveall", "freeze", "range", "releaserange", "releasewhere", "health",
+                                       "page", "rank", "counter", "team"};
+
 
 // PRE MADE FUNCTION
 void trimWhitespace(char* str) {
@@ -93,35 +121,68 @@ int readIntSafe(const char* prompt) {
     return value;
 }
 
+int readSpeciesIdSafe(const char* prompt) {
+    while (1) {
+        printf("%s", prompt);
+        char* input = getDynamicInput();
+        if (!input) {
+            continue;
+        }
+        if (*input == '\0') {
+            printf("Invalid input.\n");
+            continue;
+        }
+
+        // Numbers are IDs, anything else is a species name
+        char* endptr;
+        errno = 0;
+        long value = strtol(input, &endptr, 10);
+        if (*endptr == '\0') {
+            // Out of range numbers are answered, not asked again
+            if (errno == ERANGE || value < 1 || value > INT_MAX) {
+                printf("Invalid ID.\n");
+                return 0;
+            }
+            return (int)value;
+        }
+        int id = findSpeciesByName(input);
+        if (id) {
+            return id;
+        }
+        printf("Unknown Pokemon name.\n");
+    }
+}
+
+// Scratch line buffer reused by every getDynamicInput call
+static char* inputScratch = NULL;
+static size_t inputScratchCap = 0;
+
 char* getDynamicInput() {
-    char* input = NULL;
-    size_t size = 0, capacity = 1;
-    input = (char* )malloc(capacity);
-    if (!input) {
+    // getline grows the buffer geometrically and keeps it between calls
+    ssize_t len = getline(&inputScratch, &inputScratchCap, stdin);
+    if (!inputScratch) {
         printf("Memory allocation failed.\n");
         return NULL;
     }
-
-    int c;
-    while ((c = getchar()) != '\n' && c != EOF) {
-        if (size + 1 >= capacity) {
-            capacity *= 2;
-            char* temp = (char* )realloc(input, capacity);
-            if (!temp) {
-                printf("Memory reallocation failed.\n");
-                free(input);
-                return NULL;
-            }
-            input = temp;
-        }
-        input[size++] = (char)c;
+    if (len < 0) {
+        len = 0;
+    }
+    if (len > 0 && inputScratch[len - 1] == '\n') {
+        len--;
     }
-    input[size] = '\0';
+    inputScratch[len] = '\0';
 
     // Trim any leading/trailing whitespace or carriage returns
-    trimWhitespace(input);
+    trimWhitespace(inputScratch);
+
+    return inputScratch;
+}
 
-    return input;
+void freeInputScratch(void) {
+    // getline allocated it with the C library itself, bypass any wrapper
+    (free)(inputScratch);
+    inputScratch = NULL;
+    inputScratchCap = 0;
 }
 
 const char* getTypeName(PokemonType type) {
@@ -166,6 +227,8 @@ const char* getTypeName(PokemonType type) {
 void BFSGeneric(PokemonNode* root, VisitNodeFunc visit) {
     // Create queue
     Queue* queue = (Queue*) malloc(sizeof(Queue));
+    queue->front = NULL;
+    queue->rear = NULL;
 
     enQueue(queue, root);
 
@@ -235,8 +298,8 @@ PokemonNode* searchPokemonBFS(PokemonNode* root, int id) {
 }
 
 // Search fir owner by ID
-OwnerNode* findOwnerByIndex(int index) {
-    OwnerNode* owner = ownerHead;
+OwnerNode* findOwnerByIndex(Registry* reg, int index) {
+    OwnerNode* owner = reg->head;
 
     for(int i = 1; i < index; i++) {
         owner = owner->next;
@@ -246,22 +309,25 @@ OwnerNode* findOwnerByIndex(int index) {
 }
 
 // Search fir owner by name
-OwnerNode* findOwnerByName(const char* name) {
-    OwnerNode* owner = ownerHead;
+OwnerNode* findOwnerByName(Registry* reg, const char* name) {
+    OwnerNode* owner = reg->head;
+    if(!owner) {
+        return NULL;
+    }
     do {
         if(strcmp(owner->ownerName, name) == 0) {
             return owner;
         }
         owner = owner->next;
-    } while (owner != ownerHead);
+    } while (owner != reg->head);
     
     return NULL;
 }
 
 // Search for min name owner
-OwnerNode* findMinOwnerName() {
+OwnerNode* findMinOwnerName(Registry* reg) {
     // Set first owner as min
-    OwnerNode* owner = ownerHead;
+    OwnerNode* owner = reg->head;
     OwnerNode* minOwner = owner;
 
     // While there are owners to check iterate them
@@ -271,7 +337,7 @@ OwnerNode* findMinOwnerName() {
             minOwner = owner;
         }
         // If no more owners left to check break loop
-        if(owner->next == ownerHead) {
+        if(owner->next == reg->head) {
             break;
         }
         // Iterate to next
@@ -284,25 +350,30 @@ OwnerNode* findMinOwnerName() {
 
 // PRINTING FUNCTIONS
 // Print all existing owners
-void printAllOwners() {
+void printAllOwners(Registry* reg) {
     int index = 1;
 
-    OwnerNode* owner = ownerHead;
+    OwnerNode* owner = reg->head;
 
     do {
         printf("%d. %s\n", index, owner->ownerName);
         index++;
         owner = owner->next;
         // While next owner exist, iterate to it
-    } while(owner != ownerHead);
+    } while(owner != reg->head);
 
     return;
 }
 
+// Chunk sink writing to a FILE*
+static void writeToFile(void* ctx, const char* data, size_t len) {
+    fwrite(data, 1, len, (FILE*) ctx);
+}
+
 // Print number of owners in given direction
-void printOwnersCircular(void) {
+void printOwnersCircular(Registry* reg) {
     // Validate owners exist
-    if(!ownerHead) {
+    if(!reg->head) {
         printf("No owners.\n");
         return;
     }
@@ -317,37 +388,115 @@ void printOwnersCircular(void) {
         printf("Enter direction (F or B): ");
         input = getDynamicInput();
     }
+    // Input lives in the scratch buffer, keep just the direction
+    int forward = input[0] == 'f' || input[0] == 'F';
 
     // Get number of prints input
     int prints = readIntSafe("How many prints? ");
 
-    OwnerNode* owner = ownerHead;
-    // Iterate owners for given number
-    for(int i = 1; i <= prints; i++) {
-        printf("[%d] %s\n", i, owner->ownerName);
+    streamOwnersCircular(reg, forward, prints, writeToFile, stdout);
+}
 
-        // Choose next owner based on direction
-        if(input[0] == 'f' || input[0] == 'F') {
-            owner = owner->next;
+// Step a decimal counter kept as text, digits start after the '['
+static void incrementCounter(char* counter, size_t* len) {
+    size_t i = *len;
+    while(i > 1 && counter[i - 1] == '9') {
+        counter[--i] = '0';
+    }
+    if(i > 1) {
+        counter[i - 1]++;
+        return;
+    }
+    // All nines, grow by one digit
+    memmove(counter + 2, counter + 1, *len - 1);
+    counter[1] = '1';
+    (*len)++;
+}
+
+// Stream owners around the ring
+void streamOwnersCircular(Registry* reg, int forward, int prints, WriteChunkFunc write, void* ctx) {
+    pthread_rwlock_rdlock(&reg->lock);
+    if(!reg->head || prints <= 0) {
+        pthread_rwlock_unlock(&reg->lock);
+        return;
+    }
+
+    // Render one cycle as "] name\n" lines, remembering where each ends
+    size_t cycleLen = 0;
+    int ringSize = 0;
+    OwnerNode* owner = reg->head;
+    do {
+        cycleLen += strlen(owner->ownerName) + 3;
+        ringSize++;
+        owner = forward ? owner->next : owner->prev;
+    } while(owner != reg->head);
+
+    char* cycle = (char*) malloc(cycleLen);
+    size_t* lineEnds = (size_t*) malloc(sizeof(size_t) * ringSize);
+    size_t at = 0;
+    for(int j = 0; j < ringSize; j++) {
+        size_t nameLen = strlen(owner->ownerName);
+        memcpy(cycle + at, "] ", 2);
+        memcpy(cycle + at + 2, owner->ownerName, nameLen);
+        cycle[at + 2 + nameLen] = '\n';
+        at += nameLen + 3;
+        lineEnds[j] = at;
+        owner = forward ? owner->next : owner->prev;
+    }
+    // The rendered cycle is all we need, writers may go on
+    pthread_rwlock_unlock(&reg->lock);
+
+    char chunk[CIRCULAR_CHUNK];
+    size_t used = 0;
+    char counter[16] = "[1";
+    size_t counterLen = 2;
+    for(int i = 0, j = 0; i < prints; i++) {
+        size_t start = j > 0 ? lineEnds[j - 1] : 0;
+        size_t lineLen = lineEnds[j] - start;
+
+        if(used + counterLen + lineLen > sizeof(chunk)) {
+            write(ctx, chunk, used);
+            used = 0;
+        }
+        if(counterLen + lineLen > sizeof(chunk)) {
+            // Line alone is bigger than a chunk
+            write(ctx, counter, counterLen);
+            write(ctx, cycle + start, lineLen);
         } else {
-            owner = owner->prev;
+            memcpy(chunk + used, counter, counterLen);
+            memcpy(chunk + used + counterLen, cycle + start, lineLen);
+            used += counterLen + lineLen;
+        }
+
+        incrementCounter(counter, &counterLen);
+        if(++j == ringSize) {
+            j = 0;
         }
     }
-    // Free direction input
-    free(input);
+    if(used > 0) {
+        write(ctx, chunk, used);
+    }
+
+    free(cycle);
+    free(lineEnds);
 }
 
 // Print a single Pokemon node
 void printPokemonNode(PokemonNode* node) {
     if (!node)
         return;
+    printPokemonData(node->data);
+}
+
+// Print a single Pokemon data
+void printPokemonData(const PokemonData* data) {
     printf("ID: %d, Name: %s, Type: %s, HP: %d, Attack: %d, Can Evolve: %s\n",
-           node->data->id,
-           node->data->name,
-           getTypeName(node->data->TYPE),
-           node->data->hp,
-           node->data->attack,
-           (node->data->CAN_EVOLVE == CAN_EVOLVE) ? "Yes" : "No");
+           data->id,
+           data->name,
+           getTypeName(data->TYPE),
+           data->hp,
+           data->attack,
+           (data->CAN_EVOLVE == CAN_EVOLVE) ? "Yes" : "No");
 }
 
 // Print BFS
@@ -395,22 +544,22 @@ NodeArray* initNodeArray(int cap) {
     NodeArray* array = (NodeArray*) malloc(sizeof(NodeArray));
     array->size = 0;
     array->capacity = cap;
-    array->nodes = malloc(sizeof(PokemonNode) * cap);
+    array->nodes = malloc(sizeof(PokemonNode*) * cap);
     
     return array;
 }
 
 // Add node to NodeArray
 void addNode(NodeArray* array, PokemonNode* node) {
+    // Resize if needed, doubling keeps bulk collection linear
+    if(array->size == array->capacity) {
+        array->capacity = array->capacity > 0 ? array->capacity * 2 : 5;
+        array->nodes = realloc(array->nodes, sizeof(PokemonNode*) * array->capacity);
+    }
+
     // Add node
     array->nodes[array->size] = node;
     array->size++;
-
-    // Resize if needed
-    if(array->capacity < array->size) {
-        array->capacity += 5;
-        array->nodes = realloc(array->nodes, sizeof(PokemonNode) * array->capacity);
-    }
 }
 
 // Enter a node to the queue
@@ -419,6 +568,7 @@ void enQueue(Queue* queue, PokemonNode* node) {
     QueueNode* queueNode = (QueueNode*) malloc(sizeof(QueueNode));
     // Insert data
     queueNode->node = node;
+    queueNode->next = NULL;
 
     // If first node
     if(!queue->rear) {
@@ -484,10 +634,11 @@ void sortArray(NodeArray* array) {
         PokemonNode* temp;
         swap = 0;
         current = 0;
-        // Get current and next nodes
-        node = array->nodes[current];
-        nextNode = array->nodes[current + 1];
-        while(nextNode != NULL) {
+        // Walk adjacent pairs within the array
+        while(current + 1 < array->size) {
+            // Get current and next nodes
+            node = array->nodes[current];
+            nextNode = array->nodes[current + 1];
             // If names unordered swap nodes
             if(strcmp(node->data->name, nextNode->data->name) > 0) {
                 swap = 1;
@@ -497,8 +648,6 @@ void sortArray(NodeArray* array) {
             }
             // Iterate to next nodes
             current++;
-            node = array->nodes[current];
-            nextNode = array->nodes[current + 1];
         }
     }
     
@@ -510,30 +659,23 @@ void sortArray(NodeArray* array) {
 // Add new Pokemon to pokedex
 void addPokemon(OwnerNode* owner) {
     // Get input
-    int id = readIntSafe("Enter ID to add: ");
+    int id = readSpeciesIdSafe("Enter ID to add: ");
+    if(!id) {
+        return;
+    }
 
-    // Continue only if Pokemon exist
-    if(owner->pokedexRoot && searchPokemonBFS(owner->pokedexRoot, id)) {
+    // Continue only if Pokemon not exist
+    OpStatus status = ownerAddPokemon(owner, id);
+    if(status == OP_DUPLICATE) {
         printf("Pokemon with ID %d is already in the Pokedex. No changes made.\n", id);
         return;
     }
-
-    // Gather data
-    PokemonData* data = (PokemonData*) malloc(sizeof(PokemonData));
-    *data = pokedex[id-1];
-
-    // Create the Pokemon node
-    PokemonNode* pokemon = createPokemonNode(data);
-
-    // Add Pokemon node to pokedex
-    if(!owner->pokedexRoot) {
-        owner->pokedexRoot = pokemon;
-    } else {
-        insertPokemonNode(owner->pokedexRoot, pokemon);
+    if(status == OP_INVALID) {
+        printf("Invalid ID.\n");
+        return;
     }
-    
-    printf("Pokemon %s (ID %d) added.\n", pokemon->data->name, pokemon->data->id);
 
+    printf("Pokemon %s (ID %d) added.\n", getSpecies(id)->name, id);
 }
 
 // Free Pokemon from pokedex
@@ -545,17 +687,125 @@ void freePokemon(OwnerNode* owner) {
     }
 
     // Get input
-    int id = readIntSafe("Enter Pokemon ID to release: ");
+    int id = readSpeciesIdSafe("Enter Pokemon ID to release: ");
+    if(!id) {
+        return;
+    }
     // Continue only if Pokemon exists in pokedex
-    if(!searchPokemonBFS(owner->pokedexRoot, id)) {
+    if(ownerReleasePokemon(owner, id) != OP_OK) {
         printf("No Pokemon with ID %d found.\n", id);
         return;
     }
 
-    // Remove Pokemon node from the BST
-    removeNodeBST(owner->pokedexRoot, owner->pokedexRoot, owner, id);
-    
-    printf("Removing Pokemon %s (ID %d).\n", pokedex[id-1].name, id);
+    printf("Removing Pokemon %s (ID %d).\n", getSpecies(id)->name, id);
+}
+
+// Display Pokemons in ID range
+void displayRangeMenu(OwnerNode* owner) {
+    // Validate pokedex exist
+    if(!owner->pokedexRoot) {
+        printf("Pokedex is empty.\n");
+        return;
+    }
+
+    // Get input
+    int low = readSpeciesIdSafe("Enter lowest ID: ");
+    int high = readSpeciesIdSafe("Enter highest ID: ");
+    if(!low || !high) {
+        return;
+    }
+
+    PersistentNode* snapshot = acquirePokedexSnapshot(owner);
+    if(snapshotRange(snapshot, low, high, printPokemonData) == 0) {
+        printf("No Pokemon with IDs %d to %d.\n", low, high);
+    }
+    releasePersistent(snapshot);
+}
+
+// Display a page menu entry
+void displayPageMenu(OwnerNode* owner) {
+    // Validate pokedex exist
+    if(!owner->pokedexRoot) {
+        printf("Pokedex is empty.\n");
+        return;
+    }
+
+    // Get input
+    int first = readIntSafe("Start at position: ");
+    int count = readIntSafe("How many: ");
+
+    PersistentNode* snapshot = acquirePokedexSnapshot(owner);
+    int total = snapshot ? snapshot->size : 0;
+    if(snapshotPage(snapshot, first, count, printPokemonData) == 0) {
+        printf("Nothing to show, positions run from 1 to %d.\n", total);
+    }
+    releasePersistent(snapshot);
+}
+
+// Select and rank menu entry
+void rankMenu(OwnerNode* owner) {
+    // Validate pokedex exist
+    if(!owner->pokedexRoot) {
+        printf("Pokedex is empty.\n");
+        return;
+    }
+
+    printf("1. Pokemon at position\n");
+    printf("2. Position of Pokemon\n");
+    int choice = readIntSafe("Your choice: ");
+    if(choice != 1 && choice != 2) {
+        printf("Invalid choice.\n");
+        return;
+    }
+    int value = choice == 1 ? readIntSafe("Enter position: ") : readSpeciesIdSafe("Enter ID: ");
+    if(choice == 2 && !value) {
+        return;
+    }
+
+    PersistentNode* snapshot = acquirePokedexSnapshot(owner);
+    int total = snapshot ? snapshot->size : 0;
+    if(choice == 1) {
+        const PokemonData* data = snapshotSelect(snapshot, value);
+        if(data) {
+            printPokemonData(data);
+        } else {
+            printf("Positions run from 1 to %d.\n", total);
+        }
+    } else {
+        int rank = snapshotRank(snapshot, value);
+        if(rank) {
+            printf("ID %d is number %d of %d.\n", value, rank, total);
+        } else {
+            printf("No Pokemon with ID %d.\n", value);
+        }
+    }
+    releasePersistent(snapshot);
+}
+
+// Release Pokemons in ID range
+void releaseRangeMenu(OwnerNode* owner) {
+    // Validate pokedex exist
+    if(!owner->pokedexRoot) {
+        printf("No Pokemon to release.\n");
+        return;
+    }
+
+    // Get input
+    int low = readSpeciesIdSafe("Enter lowest ID to release: ");
+    int high = readSpeciesIdSafe("Enter highest ID to release: ");
+    if(!low || !high) {
+        return;
+    }
+
+    int released;
+    OpStatus status = ownerReleaseRange(owner, low, high, &released);
+    if(status == OP_INVALID) {
+        printf("Invalid range.\n");
+    } else if(status != OP_OK) {
+        printf("No Pokemon with IDs %d to %d found.\n", low, high);
+    } else {
+        printf("Released %d Pokemon with IDs %d to %d.\n", released, low, high);
+    }
 }
 
 // Evolve pokemon in pokedex
@@ -567,24 +817,47 @@ void evolvePokemon(OwnerNode* owner) {
     }
 
     //Get input
-    int index = readIntSafe("Your choice: ");
+    int index = readSpeciesIdSafe("Your choice: ");
+    if(!index) {
+        return;
+    }
 
-    // Find requested pokemon
-    PokemonNode* pokemon = searchPokemonBFS(owner->pokedexRoot, index);
+    PokemonData before, after;
+    OpStatus status = ownerEvolvePokemon(owner, index, &before, &after);
 
     // If Pokemon not exist
-    if(!pokemon) {
+    if(status == OP_NOT_FOUND || status == OP_EMPTY) {
         printf("No Pokemon with ID %d found.\n", index);
     // If Pokemon cannot evolve
-    } else if(pokemon->data->CAN_EVOLVE == CANNOT_EVOLVE) {
-        printf("%s (ID %d) cannot evolve.", pokemon->data->name, pokemon->data->id);
+    } else if(status == OP_CANNOT_EVOLVE) {
+        printf("%s (ID %d) cannot evolve.", before.name, before.id);
+    // If evolved form is already there
+    } else if(status == OP_DUPLICATE) {
+        printf("Evolution ID %d (%s) already in the Pokedex. Releasing %s (ID %d).\n",
+               after.id, after.name, before.name, before.id);
     } else {
-        *pokemon->data = pokedex[index + 1];
+        printf("Pokemon evolved from %s (ID %d) to %s (ID %d).\n", before.name, before.id, after.name, after.id);
     }
 
     return;
 }
 
+// Evolve all eligible pokemon in pokedex
+void evolveAllPokemon(OwnerNode* owner) {
+    // Validate pokedex exists
+    if(!owner->pokedexRoot) {
+        printf("Cannot evolve. Pokedex empty.\n");
+        return;
+    }
+
+    // Get input
+    int toFinal = readIntSafe("Evolve to final form? (1 = yes, 0 = one step): ");
+
+    int evolved, released;
+    ownerEvolveAll(owner, toFinal == 1, &evolved, &released);
+    printf("Evolved %d Pokemon, released %d duplicates.\n", evolved, released);
+}
+
 // Make fight with 2 Pokemons
 void pokemonFight(OwnerNode* owner) {
     // Validate pokedex exists
@@ -594,499 +867,6124 @@ void pokemonFight(OwnerNode* owner) {
     }
 
     // Get input
-    int index1 = readIntSafe("Enter ID of the first Pokemon: ");
-    int index2 = readIntSafe("Enter ID of the second Pokemon: ");
-
-    // Find requested Pokemons
-    PokemonNode* pokemon1 = searchPokemonBFS(owner->pokedexRoot, index1);
-    PokemonNode* pokemon2 = searchPokemonBFS(owner->pokedexRoot, index2);
+    int index1 = readSpeciesIdSafe("Enter ID of the first Pokemon: ");
+    int index2 = readSpeciesIdSafe("Enter ID of the second Pokemon: ");
+    if(!index1 || !index2) {
+        return;
+    }
 
+    FightResult result;
     // If missing at least one
-    if(!pokemon1 || !pokemon2) {
+    if(ownerFight(owner, index1, index2, &result) != OP_OK) {
         printf("One or both Pokemon IDs not found.\n");
         return;
     }
 
-    // Calculate scores
-    float score1 = (pokemon1->data->attack * 1.5) + (pokemon1->data->hp * 1.2);
-    float score2 = (pokemon2->data->attack * 1.5) + (pokemon2->data->hp * 1.2);
-
-    printf("Pokemon 1: %s (Score = %.2f)\n", pokemon1->data->name, score1);
-    printf("Pokemon 2: %s (Score = %.2f)\n", pokemon2->data->name, score2);
-
-    // Determine winner
-    PokemonNode* winner = score1 > score2 ? pokemon1 : (score1 < score2 ? pokemon2 : NULL);
+    printf("Pokemon 1: %s (Score = %.2f)\n", result.first.name, result.score1);
+    printf("Pokemon 2: %s (Score = %.2f)\n", result.second.name, result.score2);
 
-    if(winner) {
-        printf("%s wins!\n", winner->data->name);
+    // Print winner
+    if(result.winner == 1) {
+        printf("%s wins!\n", result.first.name);
+    } else if(result.winner == 2) {
+        printf("%s wins!\n", result.second.name);
     } else {
         printf("It's a tie!\n");
     }
 }
 
-
-// OWNER SPECIFIC FUNCTIONS
-// Add new owner
-void openPokedexMenu() {
-    char* name;
-    int starter, id;
-
-    // Get name
-    printf("Your name: ");
-    name = getDynamicInput();
-
-    // Validate name not exist
-    if(ownerHead && findOwnerByName(name)) {
-        printf("Owner '%s' already exists. Not creating a new Pokedex.\n", name);
-        free(name);
-        return;
+// Height in edges of a subtree, -1 when empty
+static int subtreeHeight(const PokemonNode* node) {
+    if(!node) {
+        return -1;
     }
+    int left = subtreeHeight(node->left);
+    int right = subtreeHeight(node->right);
+    return 1 + (left > right ? left : right);
+}
 
-    // Choose starter
-    printf("Choose Starter:\n\
-    1. Bulbasaur\n\
-    2. Charmander\n\
-    3. Squirtle\n");
-    starter = readIntSafe("Your choice: ");
-    // Get Pokemon ID by user choice
-    id = 3 * starter - 3;
-
-    PokemonData* data;
-    PokemonNode* pokemon;
-    
-    // Gather Pokemon data
-    data = (PokemonData*) malloc(sizeof(PokemonData));
-    *data = pokedex[id];
+// Left subtree root that a two child removal re-hangs deeper, 0 if none.
+// Its height is only measured when auto rebalance is on
+static int movedSubtreeId(OwnerNode* owner, int id, int* height) {
+    PokemonNode* node = searchPokemonBST(owner->pokedexRoot, id);
+    *height = 0;
+    if(!node || !node->left || !node->right) {
+        return 0;
+    }
+    if(owner->rebalanceDepth > 0) {
+        *height = subtreeHeight(node->left);
+    }
+    return node->left->data->id;
+}
 
-    // Create new Pokemon node
-    pokemon = createPokemonNode(data);
+// Count a Pokemon into the owner totals
+static void addToTotals(PokedexTotals* totals, const PokemonData* data) {
+    totals->count++;
+    totals->hpSum += data->hp;
+    totals->attackSum += data->attack;
+    totals->typeCount[data->TYPE]++;
+}
 
-    // Create new owner with starter
-    createOwner(name, pokemon);
+// Take a Pokemon out of the owner totals
+static void removeFromTotals(PokedexTotals* totals, const PokemonData* data) {
+    totals->count--;
+    totals->hpSum -= data->hp;
+    totals->attackSum -= data->attack;
+    totals->typeCount[data->TYPE]--;
 }
 
-// Delete owner
-void deletePokedex(void) {
-    // Validate owners exists
-    if(!ownerHead) {
-        printf("No existing Pokedexes to delete.\n");
+// Take a whole detached subtree out of the owner totals
+static void removeTreeFromTotals(PokedexTotals* totals, PokemonNode* root) {
+    if(!root) {
         return;
     }
+    removeFromTotals(totals, root->data);
+    removeTreeFromTotals(totals, root->left);
+    removeTreeFromTotals(totals, root->right);
+}
 
-    // Print all owners
-    printf("\n=== Delete a Pokedex ===\n");
-    printAllOwners();
+// Best fight score first, lower ID on ties
+static int compareFightScore(const void* a, const void* b) {
+    const PokemonData* first = (const PokemonData*) a;
+    const PokemonData* second = (const PokemonData*) b;
+    double score1 = (first->attack * 1.5) + (first->hp * 1.2);
+    double score2 = (second->attack * 1.5) + (second->hp * 1.2);
+    if(score1 != score2) {
+        return score1 > score2 ? -1 : 1;
+    }
+    return (first->id > second->id) - (first->id < second->id);
+}
 
-    // Get input
-    int index = readIntSafe("Choose a Pokedex to delete by number: ");
-    // Find requested owner
-    OwnerNode* owner = findOwnerByIndex(index);
+// Counter index the owner may change, copied first if a reader still holds it
+static CounterIndex* writableCounterIndex(OwnerNode* owner) {
+    CounterIndex* index = owner->counters;
+    // Readers only take a reference under the owner lock, which we hold
+    if(!index || __atomic_load_n(&index->refs, __ATOMIC_ACQUIRE) == 1) {
+        return index;
+    }
+    CounterIndex* copy = (CounterIndex*) malloc(sizeof(CounterIndex));
+    *copy = *index;
+    copy->data = (PokemonData*) malloc(sizeof(PokemonData) * copy->capacity);
+    memcpy(copy->data, index->data, sizeof(PokemonData) * index->start[TYPE_COUNT]);
+    copy->refs = 1;
+    owner->counters = copy;
+    releaseCounterIndex(index);
+    return copy;
+}
 
-    // Delete owner
-    printf("Deleting %s's entire Pokedex...\n", owner->ownerName);
-    freeOwnerNode(owner);
-    printf("Pokedex deleted.\n");
+// First slot of a type group not before data
+static int counterSlot(const CounterIndex* index, const PokemonData* data) {
+    int low = index->start[data->TYPE], high = index->start[data->TYPE + 1];
+    while(low < high) {
+        int mid = low + (high - low) / 2;
+        if(compareFightScore(&index->data[mid], data) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
 }
 
-// Delete all existing owners
-void freeAllOwners() {
-    // Validate owners exist
-    if(!ownerHead) {
+// Put a Pokemon into its type group of the counter index
+static void addToCounterIndex(OwnerNode* owner, const PokemonData* data) {
+    CounterIndex* index = writableCounterIndex(owner);
+    if(!index) {
         return;
     }
-    OwnerNode* owner = ownerHead;
-    OwnerNode* temp;
-
-    // Continue while there are owners to delete
-    while(1) {
-        if(owner == owner->next) {
-            freeOwnerNode(owner);
-            ownerHead = NULL;
-            break;
-        }
-        // Free owner and iterate to next
-        temp = owner;
-        owner = owner->next;
-        freeOwnerNode(temp);
+    int total = index->start[TYPE_COUNT];
+    if(total == index->capacity) {
+        index->capacity *= 2;
+        index->data = (PokemonData*) realloc(index->data, sizeof(PokemonData) * index->capacity);
+    }
+    int slot = counterSlot(index, data);
+    memmove(index->data + slot + 1, index->data + slot, sizeof(PokemonData) * (total - slot));
+    index->data[slot] = *data;
+    for(int t = data->TYPE + 1; t <= TYPE_COUNT; t++) {
+        index->start[t]++;
     }
 }
 
-// Merge one owner to another
-void mergePokedexMenu(void) {
-    // Validate owners exist
-    if(!ownerHead || (ownerHead && ownerHead->next == ownerHead)) {
-        printf("Not enough owners to merge.\n");
+// Take a Pokemon out of its type group of the counter index
+static void removeFromCounterIndex(OwnerNode* owner, const PokemonData* data) {
+    CounterIndex* index = writableCounterIndex(owner);
+    if(!index) {
         return;
     }
+    int total = index->start[TYPE_COUNT];
+    int slot = counterSlot(index, data);
+    memmove(index->data + slot, index->data + slot + 1, sizeof(PokemonData) * (total - slot - 1));
+    for(int t = data->TYPE + 1; t <= TYPE_COUNT; t++) {
+        index->start[t]--;
+    }
+}
 
-    // Get input
-    printf("\n=== Merge Pokedexes ===\n");
-    printf("Enter name of first owner: ");
-    char* name1 = getDynamicInput();
-    printf("Enter name of second owner: ");
-    char* name2 = getDynamicInput();
+// Bulk writes touch most of the Pokedex, rebuilding later costs the same
+static void dropCounterIndex(OwnerNode* owner) {
+    CounterIndex* index = owner->counters;
+    owner->counters = NULL;
+    releaseCounterIndex(index);
+}
 
-    // Find requested owners
-    OwnerNode* owner1 = findOwnerByName(name1);
-    OwnerNode* owner2 = findOwnerByName(name2);
+// Insert Pokemon to owner pokedex under owner lock
+OpStatus ownerAddPokemon(OwnerNode* owner, int id) {
+    // Validate ID against the catalog
+    const PokemonData* species = getSpecies(id);
+    if(!species) {
+        return OP_INVALID;
+    }
 
-    printf("Merging %s and %s...\n", name1, name2);
+    pthread_mutex_lock(&owner->lock);
+    thawPokedex(owner);
 
-    // Create array for second owner pokedex
-    NodeArray* array = initNodeArray(5);
-    collectAll(owner2->pokedexRoot, array);
+    // Continue only if Pokemon not exist
+    if(owner->pokedexRoot && searchPokemonBFS(owner->pokedexRoot, id)) {
+        pthread_mutex_unlock(&owner->lock);
+        return OP_DUPLICATE;
+    }
 
-    // Add each Pokemon to first owner
-    for(int i = 0; i < array->size; i++) {
-        // Validate Pokemon not allready in first owner
-        if(!searchPokemonBFS(owner1->pokedexRoot, array->nodes[i]->data->id)) {
-            PokemonNode* pokemon = array->nodes[i];
-            pokemon->left = NULL;
-            pokemon->right = NULL;
-            insertPokemonNode(owner1->pokedexRoot, pokemon);
-        } else {
-            // If Pokemon allready in first owner free it
-            freePokemonNode(array->nodes[i]);
-        }
+    // Gather data
+    PokemonData* data = (PokemonData*) malloc(sizeof(PokemonData));
+    *data = *species;
+
+    // Create the Pokemon node
+    PokemonNode* pokemon = createPokemonNode(data);
+
+    // Add Pokemon node to pokedex
+    if(!owner->pokedexRoot) {
+        owner->pokedexRoot = pokemon;
+    } else {
+        insertPokemonNode(owner->pokedexRoot, pokemon);
     }
-    printf("Merge completed.\n");
+    publishSnapshot(owner, persistentInsert(owner->snapshot, data));
+    addToTotals(&owner->totals, data);
+    addToCounterIndex(owner, data);
+    maybeRebalance(owner, depthOfPokemon(owner->pokedexRoot, id));
 
-    // Free all not needed data
-    owner2->pokedexRoot = NULL;
-    freeOwnerNode(owner2);
-    printf("Owner '%s' has been removed after merging.\n", name2);
-    free(name1);
-    free(name2);
-    free(array->nodes);
-    free(array);
+    pthread_mutex_unlock(&owner->lock);
+    return OP_OK;
 }
 
-// Sort owners alphabetically
-void sortOwners(void) {
-    // Check if at least 2 owners exist
-    if(!ownerHead || (ownerHead && ownerHead->next == ownerHead)) {
-        printf("0 or 1 owners only => no need to sort.\n");
-        return;
-    }
+// Remove Pokemon from owner pokedex under owner lock
+OpStatus ownerReleasePokemon(OwnerNode* owner, int id) {
+    OpStatus status = OP_OK;
+    pthread_mutex_lock(&owner->lock);
 
-    // Find min name owner
-    OwnerNode* firstOwner = findMinOwnerName();
+    PokemonNode* pokemon = owner->pokedexRoot ? searchPokemonBFS(owner->pokedexRoot, id) : NULL;
+    if(!owner->pokedexRoot) {
+        status = OP_EMPTY;
+    } else if(!pokemon) {
+        status = OP_NOT_FOUND;
+    } else {
+        // Remove Pokemon node from the BST
+        thawPokedex(owner);
+        removeFromTotals(&owner->totals, pokemon->data);
+        removeFromCounterIndex(owner, pokemon->data);
+        int movedHeight;
+        int moved = movedSubtreeId(owner, id, &movedHeight);
+        removeNodeBST(owner->pokedexRoot, owner->pokedexRoot, owner, id);
+        publishSnapshot(owner, persistentRemove(owner->snapshot, id));
+        // Deepest leaf of the moved subtree, not just its root
+        maybeRebalance(owner, depthOfPokemon(owner->pokedexRoot, moved) + movedHeight);
+    }
+
+    pthread_mutex_unlock(&owner->lock);
+    return status;
+}
+
+// Count nodes of a detached subtree
+static int countTreeNodes(PokemonNode* root) {
+    return root ? 1 + countTreeNodes(root->left) + countTreeNodes(root->right) : 0;
+}
+
+// Any ID within low..high, one root to leaf walk
+static int treeHasIdInRange(PokemonNode* root, int low, int high) {
+    while(root) {
+        if(root->data->id < low) {
+            root = root->right;
+        } else if(root->data->id > high) {
+            root = root->left;
+        } else {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Release ID range from owner pokedex under owner lock
+OpStatus ownerReleaseRange(OwnerNode* owner, int low, int high, int* released) {
+    *released = 0;
+    if(low > high) {
+        return OP_INVALID;
+    }
+    // No Pokemon has an ID past the catalog, so high + 1 cannot overflow
+    if(high > speciesCount()) {
+        high = speciesCount();
+    }
+    pthread_mutex_lock(&owner->lock);
+    if(!owner->pokedexRoot) {
+        pthread_mutex_unlock(&owner->lock);
+        return OP_EMPTY;
+    }
+    // The cut and join reshape the tree, so leave it alone when nothing goes
+    if(!treeHasIdInRange(owner->pokedexRoot, low, high)) {
+        pthread_mutex_unlock(&owner->lock);
+        return OP_NOT_FOUND;
+    }
+
+    // Cut the tree into below, inside and above the range
+    thawPokedex(owner);
+    dropCounterIndex(owner);
+    PokemonNode *below, *inside, *above;
+    splitTreeById(owner->pokedexRoot, low, &below, &inside);
+    splitTreeById(inside, high + 1, &inside, &above);
+    *released = countTreeNodes(inside);
+    removeTreeFromTotals(&owner->totals, inside);
+    freePokemonNode(inside);
+    owner->pokedexRoot = joinTrees(below, above);
+
+    // Same cut and join on the snapshot keeps both shapes equal
+    PersistentNode *pBelow, *pInside, *pAbove;
+    persistentSplit(owner->snapshot, low, &pBelow, &pInside);
+    PersistentNode* pRest = pInside;
+    persistentSplit(pRest, high + 1, &pInside, &pAbove);
+    releasePersistent(pRest);
+    releasePersistent(pInside);
+    PersistentNode* version = pBelow && pAbove ? persistentAttach(pBelow, pAbove) : retainPersistent(pBelow ? pBelow : pAbove);
+    releasePersistent(pBelow);
+    releasePersistent(pAbove);
+    publishSnapshot(owner, version);
+
+    pthread_mutex_unlock(&owner->lock);
+    return OP_OK;
+}
+
+// Evolve Pokemon in owner pokedex under owner lock
+OpStatus ownerEvolvePokemon(OwnerNode* owner, int id, PokemonData* before, PokemonData* after) {
+    OpStatus status = OP_OK;
+    pthread_mutex_lock(&owner->lock);
+
+    // Find requested pokemon
+    PokemonNode* pokemon = searchPokemonBST(owner->pokedexRoot, id);
+
+    if(!owner->pokedexRoot) {
+        status = OP_EMPTY;
+    } else if(!pokemon) {
+        status = OP_NOT_FOUND;
+    } else {
+        if(before) {
+            *before = *pokemon->data;
+        }
+        // Next species follows at the next ID
+        const PokemonData* next = getSpecies(id + 1);
+        if(after && next) {
+            *after = *next;
+        }
+        if(pokemon->data->CAN_EVOLVE == CANNOT_EVOLVE) {
+            status = OP_CANNOT_EVOLVE;
+        } else {
+            // Key changes, so take node out and put it back at its new place
+            thawPokedex(owner);
+            removeFromTotals(&owner->totals, pokemon->data);
+            removeFromCounterIndex(owner, pokemon->data);
+            int movedHeight;
+            int moved = movedSubtreeId(owner, id, &movedHeight);
+            PokemonNode* node = detachNodeBST(owner->pokedexRoot, owner->pokedexRoot, owner, id);
+            publishSnapshot(owner, persistentRemove(owner->snapshot, id));
+
+            if(searchPokemonBST(owner->pokedexRoot, id + 1)) {
+                // Evolved form already there, old one goes
+                freePokemonNode(node);
+                status = OP_DUPLICATE;
+            } else {
+                *node->data = *next;
+                if(!owner->pokedexRoot) {
+                    owner->pokedexRoot = node;
+                } else {
+                    insertPokemonNode(owner->pokedexRoot, node);
+                }
+                publishSnapshot(owner, persistentInsert(owner->snapshot, node->data));
+                addToTotals(&owner->totals, node->data);
+                addToCounterIndex(owner, node->data);
+                maybeRebalance(owner, depthOfPokemon(owner->pokedexRoot, id + 1));
+            }
+            maybeRebalance(owner, depthOfPokemon(owner->pokedexRoot, moved) + movedHeight);
+        }
+    }
+
+    pthread_mutex_unlock(&owner->lock);
+    return status;
+}
+
+// Compare nodes by ID for qsort
+static int compareNodesById(const void* a, const void* b) {
+    const PokemonNode* x = *(PokemonNode* const*) a;
+    const PokemonNode* y = *(PokemonNode* const*) b;
+    return (x->data->id > y->data->id) - (x->data->id < y->data->id);
+}
+
+// Evolve every eligible Pokemon, then rebuild tree once
+OpStatus ownerEvolveAll(OwnerNode* owner, int toFinal, int* evolved, int* released) {
+    *evolved = 0;
+    *released = 0;
+    pthread_mutex_lock(&owner->lock);
+
+    if(!owner->pokedexRoot) {
+        pthread_mutex_unlock(&owner->lock);
+        return OP_EMPTY;
+    }
+
+    // One pass over all nodes
+    thawPokedex(owner);
+    dropCounterIndex(owner);
+    NodeArray* array = initNodeArray(5);
+    collectAll(owner->pokedexRoot, array);
+    for(int i = 0; i < array->size; i++) {
+        PokemonData* data = array->nodes[i]->data;
+        if(data->CAN_EVOLVE == CAN_EVOLVE) {
+            (*evolved)++;
+            removeFromTotals(&owner->totals, data);
+            // Step once, or until the final form
+            while(data->CAN_EVOLVE == CAN_EVOLVE) {
+                *data = *getSpecies(data->id + 1);
+                if(!toFinal) {
+                    break;
+                }
+            }
+            addToTotals(&owner->totals, data);
+        }
+    }
+
+    // Order by new IDs and drop duplicates
+    qsort(array->nodes, array->size, sizeof(PokemonNode*), compareNodesById);
+    int kept = 0;
+    for(int i = 0; i < array->size; i++) {
+        if(kept > 0 && array->nodes[kept - 1]->data->id == array->nodes[i]->data->id) {
+            removeFromTotals(&owner->totals, array->nodes[i]->data);
+            array->nodes[i]->left = NULL;
+            array->nodes[i]->right = NULL;
+            freePokemonNode(array->nodes[i]);
+            (*released)++;
+        } else {
+            array->nodes[kept++] = array->nodes[i];
+        }
+    }
+
+    // Single rebuild for the whole batch
+    owner->pokedexRoot = buildBalancedTree(array->nodes, kept);
+    publishSnapshot(owner, persistentFromTree(owner->pokedexRoot));
+    pthread_mutex_unlock(&owner->lock);
+
+    free(array->nodes);
+    free(array);
+    return OP_OK;
+}
+
+// Score a fight under owner lock
+OpStatus ownerFight(OwnerNode* owner, int id1, int id2, FightResult* result) {
+    pthread_mutex_lock(&owner->lock);
+
+    if(!owner->pokedexRoot) {
+        pthread_mutex_unlock(&owner->lock);
+        return OP_EMPTY;
+    }
+
+    // Find requested Pokemons, in the array when frozen
+    FrozenPokedex* frozen = owner->frozen;
+    const PokemonData* data1;
+    const PokemonData* data2;
+    if(frozen) {
+        int at1 = frozenSearch(frozen, id1), at2 = frozenSearch(frozen, id2);
+        data1 = at1 ? getSpecies(id1) : NULL;
+        data2 = at2 ? getSpecies(id2) : NULL;
+    } else {
+        PokemonNode* pokemon1 = searchPokemonBST(owner->pokedexRoot, id1);
+        PokemonNode* pokemon2 = searchPokemonBST(owner->pokedexRoot, id2);
+        data1 = pokemon1 ? pokemon1->data : NULL;
+        data2 = pokemon2 ? pokemon2->data : NULL;
+    }
+    if(!data1 || !data2) {
+        pthread_mutex_unlock(&owner->lock);
+        return OP_NOT_FOUND;
+    }
+
+    // Copy data out so it stays valid after unlocking
+    result->first = *data1;
+    result->second = *data2;
+    pthread_mutex_unlock(&owner->lock);
+
+    // Calculate scores
+    result->score1 = (result->first.attack * 1.5) + (result->first.hp * 1.2);
+    result->score2 = (result->second.attack * 1.5) + (result->second.hp * 1.2);
+
+    // Determine winner
+    result->winner = result->score1 > result->score2 ? 1 : (result->score1 < result->score2 ? 2 : 0);
+
+    return OP_OK;
+}
+
+// Read owner totals under owner lock
+void ownerPokedexSummary(OwnerNode* owner, PokedexTotals* totals, int* maxAttack) {
+    pthread_mutex_lock(&owner->lock);
+    *totals = owner->totals;
+    // Snapshot root carries the maximum of the whole tree
+    *maxAttack = owner->snapshot ? owner->snapshot->maxAttack : 0;
+    pthread_mutex_unlock(&owner->lock);
+}
+
+// Lock two owners, lower serial first
+void lockOwnerPair(OwnerNode* a, OwnerNode* b) {
+    if(a == b) {
+        pthread_mutex_lock(&a->lock);
+        return;
+    }
+    OwnerNode* first = a->serial < b->serial ? a : b;
+    OwnerNode* second = first == a ? b : a;
+    pthread_mutex_lock(&first->lock);
+    pthread_mutex_lock(&second->lock);
+}
+
+// Unlock two owners
+void unlockOwnerPair(OwnerNode* a, OwnerNode* b) {
+    pthread_mutex_unlock(&a->lock);
+    if(a != b) {
+        pthread_mutex_unlock(&b->lock);
+    }
+}
+
+
+// OWNER SPECIFIC FUNCTIONS
+// Add new owner
+void openPokedexMenu(Registry* reg) {
+    char* name;
+    int starter;
+
+    // Get name
+    printf("Your name: ");
+    name = getDynamicInput();
+
+    // Validate name not exist
+    pthread_rwlock_rdlock(&reg->lock);
+    OwnerNode* existing = findOwnerByName(reg, name);
+    pthread_rwlock_unlock(&reg->lock);
+    if(existing) {
+        printf("Owner '%s' already exists. Not creating a new Pokedex.\n", name);
+        return;
+    }
+
+    // Choose starter
+    printf("Choose Starter:\n");
+    for(int i = 1; i <= 3; i++) {
+        const PokemonData* species = getSpecies(3 * i - 2);
+        printf("    %d. %s\n", i, species ? species->name : "(not in catalog)");
+    }
+    starter = readIntSafe("Your choice: ");
+
+    // Create new owner with starter
+    OpStatus status = registryOpenOwner(reg, name, starter);
+    if(status == OP_OK) {
+        printf("New Pokedex created for %s with starter %s.\n", name, getSpecies(3 * starter - 2)->name);
+    } else if(status == OP_DUPLICATE) {
+        printf("Owner '%s' already exists. Not creating a new Pokedex.\n", name);
+    } else {
+        printf("Invalid choice.\n");
+    }
+}
+
+// Create owner with a starter
+OpStatus registryOpenOwner(Registry* reg, const char* name, int starter) {
+    // Validate starter choice
+    if(starter < 1 || starter > 3) {
+        return OP_INVALID;
+    }
+    // Get Pokemon by user choice
+    const PokemonData* species = getSpecies(3 * starter - 2);
+    if(!species) {
+        return OP_INVALID;
+    }
+
+    pthread_rwlock_wrlock(&reg->lock);
+    // Validate name not exist
+    if(findOwnerByName(reg, name)) {
+        pthread_rwlock_unlock(&reg->lock);
+        return OP_DUPLICATE;
+    }
+
+    // Gather Pokemon data
+    PokemonData* data = (PokemonData*) malloc(sizeof(PokemonData));
+    *data = *species;
+
+    // Create new owner with starter
+    createOwner(reg, name, createPokemonNode(data));
+    pthread_rwlock_unlock(&reg->lock);
+
+    return OP_OK;
+}
+
+// Delete owner
+void deletePokedex(Registry* reg) {
+    // Validate owners exists
+    if(!reg->head) {
+        printf("No existing Pokedexes to delete.\n");
+        return;
+    }
+
+    // Print all owners
+    printf("\n=== Delete a Pokedex ===\n");
+    pthread_rwlock_rdlock(&reg->lock);
+    printAllOwners(reg);
+    pthread_rwlock_unlock(&reg->lock);
+
+    // Get input
+    int index = readIntSafe("Choose a Pokedex to delete by number: ");
+
+    pthread_rwlock_wrlock(&reg->lock);
+    // Find requested owner
+    OwnerNode* owner = findOwnerByIndex(reg, index);
+
+    // Delete owner
+    printf("Deleting %s's entire Pokedex...\n", owner->ownerName);
+    freeOwnerNode(reg, owner);
+    printf("Pokedex deleted.\n");
+    pthread_rwlock_unlock(&reg->lock);
+}
+
+// Delete all existing owners
+void freeAllOwners(Registry* reg) {
+    pthread_rwlock_wrlock(&reg->lock);
+    // Validate owners exist
+    if(!reg->head) {
+        pthread_rwlock_unlock(&reg->lock);
+        return;
+    }
+
+    // Detach the whole ring, then tear owners down in parallel
+    int count;
+    OwnerNode** owners = collectOwners(reg, &count);
+    reg->head = NULL;
+
+    int chunks;
+    free(parallelForOwners(reg->pool, owners, count, teardownChunkTask, NULL, 1, &chunks));
+    free(owners);
+    pthread_rwlock_unlock(&reg->lock);
+}
+
+// Merge one owner to another
+void mergePokedexMenu(Registry* reg) {
+    // Validate owners exist
+    if(!reg->head || (reg->head && reg->head->next == reg->head)) {
+        printf("Not enough owners to merge.\n");
+        return;
+    }
+
+    // Get input
+    printf("\n=== Merge Pokedexes ===\n");
+    printf("Enter name of first owner: ");
+    // Second read reuses the scratch buffer, so keep a copy of the first
+    char* name1 = myStrdup(getDynamicInput());
+    printf("Enter name of second owner: ");
+    char* name2 = getDynamicInput();
+
+    printf("Merging %s and %s...\n", name1, name2);
+    if(registryMergeOwners(reg, name1, name2) != OP_OK) {
+        printf("One or both owners not found.\n");
+    } else {
+        printf("Merge completed.\n");
+        printf("Owner '%s' has been removed after merging.\n", name2);
+    }
+
+    free(name1);
+}
+
+// Merge second owner into first and remove second
+OpStatus registryMergeOwners(Registry* reg, const char* name1, const char* name2) {
+    // The ring changes, so take it exclusively
+    pthread_rwlock_wrlock(&reg->lock);
+
+    // Find requested owners
+    OwnerNode* owner1 = findOwnerByName(reg, name1);
+    OwnerNode* owner2 = findOwnerByName(reg, name2);
+
+    if(!owner1 || !owner2 || owner1 == owner2) {
+        pthread_rwlock_unlock(&reg->lock);
+        return OP_NOT_FOUND;
+    }
+
+    lockOwnerPair(owner1, owner2);
+    thawPokedex(owner1);
+    dropCounterIndex(owner1);
+
+    // Create array for second owner pokedex
+    NodeArray* array = initNodeArray(5);
+    collectAll(owner2->pokedexRoot, array);
+
+    // Add each Pokemon to first owner
+    for(int i = 0; i < array->size; i++) {
+        PokemonNode* pokemon = array->nodes[i];
+        pokemon->left = NULL;
+        pokemon->right = NULL;
+        // Validate Pokemon not allready in first owner
+        if(!owner1->pokedexRoot) {
+            owner1->pokedexRoot = pokemon;
+            addToTotals(&owner1->totals, pokemon->data);
+        } else if(!searchPokemonBFS(owner1->pokedexRoot, pokemon->data->id)) {
+            insertPokemonNode(owner1->pokedexRoot, pokemon);
+            addToTotals(&owner1->totals, pokemon->data);
+        } else {
+            // If Pokemon allready in first owner free it
+            freePokemonNode(pokemon);
+        }
+    }
+
+    // Free all not needed data
+    owner2->pokedexRoot = NULL;
+    publishSnapshot(owner1, persistentFromTree(owner1->pokedexRoot));
+    unlockOwnerPair(owner1, owner2);
+    freeOwnerNode(reg, owner2);
+    pthread_rwlock_unlock(&reg->lock);
+
+    free(array->nodes);
+    free(array);
+    return OP_OK;
+}
+
+// In-order cursor over one Pokedex for the k-way merge
+typedef struct {
+    NodeArray* stack;       // Left spine still to visit
+    PokemonNode* current;   // Next node in ID order, NULL when done
+    int source;             // Position in the merge, target is 0
+} MergeCursor;
+
+// Push the left spine below a node
+static void pushLeftSpine(NodeArray* stack, PokemonNode* node) {
+    for(; node; node = node->left) {
+        addNode(stack, node);
+    }
+}
+
+// Advance cursor to its next node
+static void advanceCursor(MergeCursor* cursor) {
+    if(cursor->stack->size == 0) {
+        cursor->current = NULL;
+        return;
+    }
+    cursor->current = cursor->stack->nodes[--cursor->stack->size];
+    pushLeftSpine(cursor->stack, cursor->current->right);
+}
+
+// Heap order: lower ID first, then earlier source
+static int cursorBefore(const MergeCursor* a, const MergeCursor* b) {
+    if(a->current->data->id != b->current->data->id) {
+        return a->current->data->id < b->current->data->id;
+    }
+    return a->source < b->source;
+}
+
+// Restore min-heap order from position i down
+static void siftCursorDown(MergeCursor** heap, int size, int i) {
+    while(1) {
+        int smallest = i, left = 2 * i + 1, right = 2 * i + 2;
+        if(left < size && cursorBefore(heap[left], heap[smallest])) {
+            smallest = left;
+        }
+        if(right < size && cursorBefore(heap[right], heap[smallest])) {
+            smallest = right;
+        }
+        if(smallest == i) {
+            return;
+        }
+        MergeCursor* temp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = temp;
+        i = smallest;
+    }
+}
+
+// Merge many owners into one
+OpStatus registryMergeMany(Registry* reg, const char* target, const char** sources, int count, int* released) {
+    *released = 0;
+    // The ring changes, so take it exclusively
+    pthread_rwlock_wrlock(&reg->lock);
+
+    // Target first, then every source, all distinct
+    int total = count + 1;
+    OwnerNode** owners = (OwnerNode**) malloc(sizeof(OwnerNode*) * total);
+    owners[0] = findOwnerByName(reg, target);
+    OpStatus status = owners[0] ? OP_OK : OP_NOT_FOUND;
+    for(int i = 1; i < total && status == OP_OK; i++) {
+        owners[i] = findOwnerByName(reg, sources[i - 1]);
+        if(!owners[i]) {
+            status = OP_NOT_FOUND;
+        }
+        for(int j = 0; j < i && status == OP_OK; j++) {
+            if(owners[j] == owners[i]) {
+                status = OP_INVALID;
+            }
+        }
+    }
+    if(status != OP_OK) {
+        pthread_rwlock_unlock(&reg->lock);
+        free(owners);
+        return status;
+    }
+
+    // Owner locks in serial order, like lockOwnerPair
+    OwnerNode** bySerial = (OwnerNode**) malloc(sizeof(OwnerNode*) * total);
+    memcpy(bySerial, owners, sizeof(OwnerNode*) * total);
+    for(int i = 1; i < total; i++) {
+        OwnerNode* owner = bySerial[i];
+        int j = i;
+        for(; j > 0 && bySerial[j - 1]->serial > owner->serial; j--) {
+            bySerial[j] = bySerial[j - 1];
+        }
+        bySerial[j] = owner;
+    }
+    for(int i = 0; i < total; i++) {
+        pthread_mutex_lock(&bySerial[i]->lock);
+    }
+    thawPokedex(owners[0]);
+    dropCounterIndex(owners[0]);
+
+    // One cursor per Pokedex, non-empty ones go on the heap
+    MergeCursor* cursors = (MergeCursor*) malloc(sizeof(MergeCursor) * total);
+    MergeCursor** heap = (MergeCursor**) malloc(sizeof(MergeCursor*) * total);
+    int heapSize = 0;
+    for(int i = 0; i < total; i++) {
+        cursors[i].stack = initNodeArray(16);
+        cursors[i].source = i;
+        pushLeftSpine(cursors[i].stack, owners[i]->pokedexRoot);
+        advanceCursor(&cursors[i]);
+        if(cursors[i].current) {
+            heap[heapSize++] = &cursors[i];
+        }
+    }
+    for(int i = heapSize / 2 - 1; i >= 0; i--) {
+        siftCursorDown(heap, heapSize, i);
+    }
+
+    // Pop the smallest ID each step, repeats of the last ID are freed
+    NodeArray* merged = initNodeArray(16);
+    while(heapSize > 0) {
+        MergeCursor* top = heap[0];
+        PokemonNode* node = top->current;
+        int source = top->source;
+        advanceCursor(top);
+        if(!top->current) {
+            heap[0] = heap[--heapSize];
+        }
+        siftCursorDown(heap, heapSize, 0);
+
+        if(merged->size > 0 && merged->nodes[merged->size - 1]->data->id == node->data->id) {
+            // Children were already pushed by the cursor, free just this node
+            free(node->data);
+            free(node);
+            (*released)++;
+        } else {
+            addNode(merged, node);
+            if(source > 0) {
+                addToTotals(&owners[0]->totals, node->data);
+            }
+        }
+    }
+
+    // Build the union once
+    owners[0]->pokedexRoot = buildBalancedTree(merged->nodes, merged->size);
+    publishSnapshot(owners[0], persistentFromTree(owners[0]->pokedexRoot));
+    for(int i = 1; i < total; i++) {
+        owners[i]->pokedexRoot = NULL;
+    }
+    for(int i = total - 1; i >= 0; i--) {
+        pthread_mutex_unlock(&bySerial[i]->lock);
+    }
+
+    // One relink pass over the sources, then free them
+    for(int i = 1; i < total; i++) {
+        removeOwnerFromCircularList(reg, owners[i]);
+    }
+    pthread_rwlock_unlock(&reg->lock);
+    for(int i = 1; i < total; i++) {
+        destroyOwner(owners[i]);
+    }
+
+    for(int i = 0; i < total; i++) {
+        free(cursors[i].stack->nodes);
+        free(cursors[i].stack);
+    }
+    free(merged->nodes);
+    free(merged);
+    free(cursors);
+    free(heap);
+    free(bySerial);
+    free(owners);
+    return OP_OK;
+}
+
+// Merge many owners menu entry
+void mergeManyMenu(Registry* reg) {
+    // Validate owners exist
+    if(!reg->head || reg->head->next == reg->head) {
+        printf("Not enough owners to merge.\n");
+        return;
+    }
+
+    // Get input, names are copied out of the scratch buffer
+    printf("\n=== Merge Many Pokedexes ===\n");
+    printf("Enter name of target owner: ");
+    char* target = myStrdup(getDynamicInput());
+    int count = 0, capacity = 4;
+    char** sources = (char**) malloc(sizeof(char*) * capacity);
+    printf("Enter names to merge in, one per line (empty line to finish):\n");
+    char* name;
+    while((name = getDynamicInput()) && *name) {
+        if(count == capacity) {
+            capacity *= 2;
+            sources = (char**) realloc(sources, sizeof(char*) * capacity);
+        }
+        sources[count++] = myStrdup(name);
+    }
+
+    int released;
+    OpStatus status = count > 0 ? registryMergeMany(reg, target, (const char**) sources, count, &released) : OP_INVALID;
+    if(status == OP_OK) {
+        printf("Merged %d owners into %s, released %d duplicates.\n", count, target, released);
+    } else if(status == OP_NOT_FOUND) {
+        printf("One or more owners not found.\n");
+    } else {
+        printf("Nothing to merge.\n");
+    }
+
+    for(int i = 0; i < count; i++) {
+        free(sources[i]);
+    }
+    free(sources);
+    free(target);
+}
+
+// Move one Pokemon node between owners
+OpStatus registryTradePokemon(Registry* reg, const char* from, const char* to, int id) {
+    // Read lock keeps both owners in the ring for the whole move
+    pthread_rwlock_rdlock(&reg->lock);
+    OwnerNode* giver = findOwnerByName(reg, from);
+    OwnerNode* receiver = findOwnerByName(reg, to);
+    if(!giver || !receiver) {
+        pthread_rwlock_unlock(&reg->lock);
+        return OP_NOT_FOUND;
+    }
+    if(giver == receiver) {
+        pthread_rwlock_unlock(&reg->lock);
+        return OP_INVALID;
+    }
+
+    lockOwnerPair(giver, receiver);
+    OpStatus status = OP_OK;
+    PokemonNode* pokemon = searchPokemonBST(giver->pokedexRoot, id);
+    if(!pokemon) {
+        status = OP_NOT_FOUND;
+    } else if(searchPokemonBST(receiver->pokedexRoot, id)) {
+        status = OP_DUPLICATE;
+    } else {
+        thawPokedex(giver);
+        thawPokedex(receiver);
+
+        // Same node, same data, only the links change
+        int movedHeight;
+        int moved = movedSubtreeId(giver, id, &movedHeight);
+        detachNodeBST(giver->pokedexRoot, giver->pokedexRoot, giver, id);
+        if(!receiver->pokedexRoot) {
+            receiver->pokedexRoot = pokemon;
+        } else {
+            insertPokemonNode(receiver->pokedexRoot, pokemon);
+        }
+        removeFromTotals(&giver->totals, pokemon->data);
+        removeFromCounterIndex(giver, pokemon->data);
+        addToTotals(&receiver->totals, pokemon->data);
+        addToCounterIndex(receiver, pokemon->data);
+
+        // Both versions change before either lock is dropped
+        publishSnapshot(giver, persistentRemove(giver->snapshot, id));
+        publishSnapshot(receiver, persistentInsert(receiver->snapshot, pokemon->data));
+        maybeRebalance(giver, depthOfPokemon(giver->pokedexRoot, moved) + movedHeight);
+        maybeRebalance(receiver, depthOfPokemon(receiver->pokedexRoot, id));
+    }
+    unlockOwnerPair(giver, receiver);
+    pthread_rwlock_unlock(&reg->lock);
+    return status;
+}
+
+// Trade menu entry
+void tradeMenu(Registry* reg) {
+    // Validate owners exist
+    if(!reg->head || reg->head->next == reg->head) {
+        printf("Not enough owners to trade.\n");
+        return;
+    }
+
+    // Get input
+    printf("\n=== Trade Pokemon ===\n");
+    printf("Enter name of giving owner: ");
+    // Later reads reuse the scratch buffer, so keep copies of both names
+    char* from = myStrdup(getDynamicInput());
+    printf("Enter name of receiving owner: ");
+    char* to = myStrdup(getDynamicInput());
+    int id = readSpeciesIdSafe("Enter ID to trade: ");
+    if(!id) {
+        free(from);
+        free(to);
+        return;
+    }
+
+    switch(registryTradePokemon(reg, from, to, id)) {
+    case OP_OK:
+        printf("%s traded ID %d to %s.\n", from, id, to);
+        break;
+    case OP_DUPLICATE:
+        printf("%s already has ID %d.\n", to, id);
+        break;
+    case OP_INVALID:
+        printf("An owner cannot trade with themselves.\n");
+        break;
+    default:
+        printf("Owner or Pokemon not found.\n");
+    }
+
+    free(from);
+    free(to);
+}
+
+// Sort owners alphabetically
+void sortOwners(Registry* reg) {
+    if(registrySortOwners(reg) != OP_OK) {
+        printf("0 or 1 owners only => no need to sort.\n");
+        return;
+    }
+
+    printf("Owners sorted by name.\n");
+}
+
+// Relink ring in name order
+OpStatus registrySortOwners(Registry* reg) {
+    pthread_rwlock_wrlock(&reg->lock);
+    // Check if at least 2 owners exist
+    if(!reg->head || (reg->head && reg->head->next == reg->head)) {
+        pthread_rwlock_unlock(&reg->lock);
+        return OP_INVALID;
+    }
+
+    // Find min name owner
+    OwnerNode* firstOwner = findMinOwnerName(reg);
     // Remove from current owners kist
-    removeOwnerFromCircularList(firstOwner);
+    removeOwnerFromCircularList(reg, firstOwner);
+
+    OwnerNode* owner = firstOwner;
+    OwnerNode* newMinOwner = NULL;
+    // If more owners exist add the to new list
+    while(reg->head) {
+        // Find second min name owner
+        newMinOwner = findMinOwnerName(reg);
+        removeOwnerFromCircularList(reg, newMinOwner);
+        owner->next = newMinOwner;
+        newMinOwner->prev = owner;
+        owner = newMinOwner;
+    }
+    // If another owner found add to new list
+    if(newMinOwner) {
+        newMinOwner->next = firstOwner;
+        firstOwner->prev = newMinOwner;
+    }
+    // When old list empty make new list head
+    reg->head = firstOwner;
+    pthread_rwlock_unlock(&reg->lock);
+
+    return OP_OK;
+}
+
+
+// DATA STRUCTURES MANIPULATING FUNCTIONS
+// Insert new Pokemon node to pokedex tree
+PokemonNode* insertPokemonNode(PokemonNode* root, PokemonNode* newNode) {  
+    int id = newNode->data->id;
+
+    if(root->data->id > id) {
+        if(!root->left) {
+            root->left = newNode;
+            return newNode;
+        }
+        return insertPokemonNode(root->left, newNode);
+    } else {
+        if(!root->right) {
+            root->right = newNode;
+            return newNode;
+        }
+        return insertPokemonNode(root->right, newNode);
+    }
+}
+
+// Remove Pokemon from pokedex tree
+void removeNodeBST(PokemonNode* root, PokemonNode* parent, OwnerNode* owner, int id) {
+    // Unlink and free node
+    freePokemonNode(detachNodeBST(root, parent, owner, id));
+}
+
+// Unlink Pokemon from pokedex tree without freeing it
+PokemonNode* detachNodeBST(PokemonNode* root, PokemonNode* parent, OwnerNode* owner, int id) {
+    if(!root) {
+        return NULL;
+    }
+
+    PokemonNode* temp;
+    InsertLocation location;
+
+    // Check if ID to remove is in this node
+    if(root->data->id == id) {
+        temp = root;
+        location = ROOT;
+    } else if(root->left && root->left->data->id == id) {
+        temp = root->left;
+        parent = root;
+        location = LEFT;
+    } else if(root->right && root->right->data->id == id) {
+        temp = root->right;
+        parent = root;
+        location = RIGHT;
+    // If ID not here iterate to next one based on ID
+    } else if(root->data->id > id) {
+        return detachNodeBST(root->left, root, owner, id);
+    } else {
+        return detachNodeBST(root->right, root, owner, id);
+    }
+
+    // Wire correct node to parent of deleted node
+    if(temp->right) {
+        if(location == RIGHT) {
+            parent->right = temp->right;
+        } else if(location == LEFT) {
+            parent->left = temp->right;
+        } else {
+            owner->pokedexRoot = temp->right;
+        }
+        if(temp->left) {
+            // Removed root is its own parent, so hang left on the new root
+            insertPokemonNode(location == ROOT ? owner->pokedexRoot : parent, temp->left);
+        }
+    } else if (temp->left) {
+        if(location == RIGHT) {
+            parent->right = temp->left;
+        } else if(location == LEFT) {
+            parent->left = temp->left;
+        } else {
+            owner->pokedexRoot = temp->left;
+        }
+    } else {
+        if(location == RIGHT) {
+            parent->right = NULL;
+        } else if(location == LEFT) {
+            parent->left = NULL;
+        } else {
+            owner->pokedexRoot = NULL;
+        }
+    }
+
+    // Clear node links
+    temp->right = NULL;
+    temp->left = NULL;
+    return temp;
+}
+
+// Search for pokemon by ID following the BST order
+PokemonNode* searchPokemonBST(PokemonNode* root, int id) {
+    while(root && root->data->id != id) {
+        root = root->data->id > id ? root->left : root->right;
+    }
+
+    return root;
+}
+
+// Build balanced tree from nodes sorted by ID
+PokemonNode* buildBalancedTree(PokemonNode** nodes, int count) {
+    if(count <= 0) {
+        return NULL;
+    }
+
+    // Middle node becomes root, halves become subtrees
+    int middle = count / 2;
+    PokemonNode* root = nodes[middle];
+    root->left = buildBalancedTree(nodes, middle);
+    root->right = buildBalancedTree(nodes + middle + 1, count - middle - 1);
+
+    return root;
+}
+
+// Split tree at an ID bound
+void splitTreeById(PokemonNode* root, int id, PokemonNode** less, PokemonNode** rest) {
+    if(!root) {
+        *less = NULL;
+        *rest = NULL;
+        return;
+    }
+
+    // Root stays on its side and keeps the near half of the split child
+    if(root->data->id < id) {
+        splitTreeById(root->right, id, &root->right, rest);
+        *less = root;
+    } else {
+        splitTreeById(root->left, id, less, &root->left);
+        *rest = root;
+    }
+}
+
+// Join trees whose ID ranges do not overlap
+PokemonNode* joinTrees(PokemonNode* left, PokemonNode* right) {
+    if(!left) {
+        return right;
+    }
+    if(right) {
+        insertPokemonNode(left, right);
+    }
+    return left;
+}
+
+// Rewire owners list for a new owner
+void linkOwnerInCircularList(Registry* reg, OwnerNode* newOwner) {
+    // If this is the first make it head
+    if(!reg->head) {
+        newOwner->next = newOwner;
+        newOwner->prev = newOwner;
+        reg->head = newOwner;
+    } else {
+        reg->head->prev->next = newOwner;
+        newOwner->prev = reg->head->prev;
+        reg->head->prev = newOwner;
+        newOwner->next = reg->head;
+    }
+
+    return;
+}
+
+// Rewire owners to remove owner
+void removeOwnerFromCircularList(Registry* reg, OwnerNode* owner) {
+    // If removed owner is the head
+    if(reg->head == owner) {
+        // If this is the only owner
+        if(owner->next == owner) {
+            reg->head = NULL;
+        } else {
+            // Rewire new head
+            owner->prev->next = owner->next;
+            owner->next->prev = owner->prev;
+            reg->head = owner->next;
+        }
+    } else {
+        // Rewire first and last owners
+        owner->prev->next = owner->next;
+        owner->next->prev = owner->prev;
+    }
+}
+
+
+// SUB-MENUS
+// Enter owner pokedex
+void enterExistingPokedexMenu(Registry* reg) {
+    // Owner must not be deleted while we are inside it
+    pthread_rwlock_rdlock(&reg->lock);
+
+    // Validate owners exist
+    if(!reg->head) {
+        pthread_rwlock_unlock(&reg->lock);
+        printf("No existing Pokedexes.\n");
+        return;
+    }
+
+    // Print all owners
+    printf("\nExisting Pokedexes:\n");
+    printAllOwners(reg);
+
+    // Get input
+    int index = readIntSafe("Choose a Pokedex by number:");
+
+    // Find requested owner
+    OwnerNode* owner = findOwnerByIndex(reg, index);
+
+    printf("\nEntering %s's Pokedex...\n", owner->ownerName);
+
+    int subChoice;
+    do {
+        // Pokedex menu
+        printf("\n-- %s's Pokedex Menu --\n", owner->ownerName);
+        printf("1. Add Pokemon\n");
+        printf("2. Display Pokedex\n");
+        printf("3. Release Pokemon (by ID)\n");
+        printf("4. Pokemon Fight!\n");
+        printf("5. Evolve Pokemon\n");
+        printf("6. Back to Main\n");
+        printf("7. Evolve All Eligible\n");
+        printf("8. Freeze Pokedex (read-optimized)\n");
+        printf("9. Display ID Range\n");
+        printf("10. Release ID Range\n");
+        printf("11. Release by Filter\n");
+        printf("12. Tree Health\n");
+        printf("13. Display Page\n");
+        printf("14. Position Lookup\n");
+        printf("15. Best Counter\n");
+        printf("16. Best Team\n");
+        // Get input
+        subChoice = readIntSafe("Your choice: ");
+        profileOperation(subChoice >= 1 && subChoice <= 16 ? pokedexMenuOps[subChoice] : pokedexMenuOps[0]);
+
+        // Direct function base on input
+        switch(subChoice) {
+        case 1:
+            addPokemon(owner);
+            break;
+        case 2:
+            displayMenu(owner);
+            break;
+        case 3:
+            freePokemon(owner);
+            break;
+        case 4:
+            pokemonFight(owner);
+            break;
+        case 5:
+            evolvePokemon(owner);
+            break;
+        case 6:
+            printf("Back to Main Menu.\n");
+            break;
+        case 7:
+            evolveAllPokemon(owner);
+            break;
+        case 8:
+            freezePokedexMenu(owner);
+            break;
+        case 9:
+            displayRangeMenu(owner);
+            break;
+        case 10:
+            releaseRangeMenu(owner);
+            break;
+        case 11:
+            releaseWhereMenu(owner);
+            break;
+        case 12:
+            treeHealthMenu(owner);
+            break;
+        case 13:
+            displayPageMenu(owner);
+            break;
+        case 14:
+            rankMenu(owner);
+            break;
+        case 15:
+            bestCounterMenu(owner);
+            break;
+        case 16:
+            bestTeamMenu(reg, owner);
+            break;
+        default:
+            printf("Invalid choice.\n");
+        }
+    } while(subChoice != 6);
+
+    pthread_rwlock_unlock(&reg->lock);
+}
+
+// Display Pokemons in pokedex
+void displayMenu(OwnerNode* owner) {
+    // Validate pokedex exist
+    if (!owner->pokedexRoot) {
+        printf("Pokedex is empty.\n");
+        return;
+    }
+
+    printf("Display:\n");
+    printf("1. BFS (Level-Order)\n");
+    printf("2. Pre-Order\n");
+    printf("3. In-Order\n");
+    printf("4. Post-Order\n");
+    printf("5. Alphabetical (by name)\n");
+    printf("6. Stats\n");
+    // Get input
+    int choice = readIntSafe("Your choice: ");
+    if(choice == 6) {
+        printPokedexSummary(owner);
+        return;
+    }
+
+    // Frozen Pokedex prints BFS straight from its array
+    FrozenPokedex* frozen = choice == 1 ? acquireFrozen(owner) : NULL;
+    if(frozen) {
+        frozenScanBFS(frozen, printPokemonData);
+        releaseFrozen(frozen);
+        return;
+    }
+
+    // Print a pinned version so writers are not blocked meanwhile
+    PersistentNode* snapshot = acquirePokedexSnapshot(owner);
+    // Direct display type base on input
+    if(!displaySnapshot(snapshot, choice, printPokemonData)) {
+        printf("Invalid choice.\n");
+    }
+    releasePersistent(snapshot);
+}
+
+// Print owner totals
+void printPokedexSummary(OwnerNode* owner) {
+    PokedexTotals totals;
+    int maxAttack;
+    ownerPokedexSummary(owner, &totals, &maxAttack);
+    if(totals.count == 0) {
+        printf("Pokedex is empty.\n");
+        return;
+    }
+
+    printf("Pokemon: %d\n", totals.count);
+    printf("Total HP: %lld, Total Attack: %lld\n", totals.hpSum, totals.attackSum);
+    printf("Average HP: %.2f, Average Attack: %.2f\n",
+           (double)totals.hpSum / totals.count, (double)totals.attackSum / totals.count);
+    printf("Max Attack: %d\n", maxAttack);
+    printf("Types:\n");
+    for(int t = 0; t < TYPE_COUNT; t++) {
+        if(totals.typeCount[t]) {
+            printf("%s: %d\n", getTypeName((PokemonType)t), totals.typeCount[t]);
+        }
+    }
+}
+
+
+// CREATE AND FREE
+// Create a new owner
+OwnerNode* createOwner(Registry* reg, const char* ownerName, PokemonNode* starter) {
+    // One allocation holds the record and the name after it
+    size_t nameSize = strlen(ownerName) + 1;
+    OwnerNode* newOwner = (OwnerNode*) malloc(sizeof(OwnerNode) + nameSize);
+
+    // Insert new owner data
+    memcpy(newOwner->ownerName, ownerName, nameSize);
+    newOwner->pokedexRoot = starter;
+    newOwner->serial = reg->nextSerial++;
+    newOwner->snapshot = persistentFromTree(starter);
+    newOwner->frozen = NULL;
+    newOwner->counters = NULL;
+    newOwner->rebalanceDepth = 0;
+    memset(&newOwner->totals, 0, sizeof(PokedexTotals));
+    if(starter) {
+        addToTotals(&newOwner->totals, starter->data);
+    }
+    pthread_mutex_init(&newOwner->lock, NULL);
+
+    // Add new owner to the list
+    linkOwnerInCircularList(reg, newOwner);
+
+    return newOwner;
+}
+
+// Free owner data
+void freeOwnerNode(Registry* reg, OwnerNode* owner) {
+    // Rewire owners list to remove owner
+    removeOwnerFromCircularList(reg, owner);
+    destroyOwner(owner);
+}
+
+// Free owner that is out of the list
+void destroyOwner(OwnerNode* owner) {
+    // Free all owner data
+    freePokemonNode(owner->pokedexRoot);
+    releasePersistent(owner->snapshot);
+    releaseFrozen(owner->frozen);
+    releaseCounterIndex(owner->counters);
+    pthread_mutex_destroy(&owner->lock);
+    free(owner);
+}
+
+// Set up empty registry
+void initRegistry(Registry* reg) {
+    reg->head = NULL;
+    reg->nextSerial = 0;
+    pthread_rwlock_init(&reg->lock, NULL);
+    reg->pool = createThreadPool(defaultPoolThreads());
+}
+
+// Free registry and everything in it
+void destroyRegistry(Registry* reg) {
+    freeAllOwners(reg);
+    destroyThreadPool(reg->pool);
+    reg->pool = NULL;
+    pthread_rwlock_destroy(&reg->lock);
+}
+
+// Create a new Pokemon node
+PokemonNode* createPokemonNode(PokemonData* data) {
+    // Allocate memory for new Pokemon
+    PokemonNode* pokemon = malloc(sizeof(PokemonNode));
+    // Insert new Pokemon data
+    pokemon->data = data;
+    pokemon->left = NULL;
+    pokemon->right = NULL;
+
+    return pokemon;
+}
+
+// Free Pokemon data
+void freePokemonNode(PokemonNode* node) {
+    if(!node) {
+        return;
+    }
+    // Check left
+    if(node->left) {
+        // Free tree from left
+        freePokemonNode(node->left);
+        node->left = NULL;
+    }
+    // Check right
+    if(node->right) {
+        // Free tree from right
+        freePokemonNode(node->right);
+        node->right = NULL;
+    }
+    // Free node and data
+    free(node->data);
+    free(node);
+
+    return;
+}
+
+// PARALLEL REGISTRY FUNCTIONS
+// Create pool and start workers
+ThreadPool* createThreadPool(int threads) {
+    ThreadPool* pool = (ThreadPool*) calloc(1, sizeof(ThreadPool));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->workReady, NULL);
+    pthread_cond_init(&pool->workDone, NULL);
+
+    pool->threads = threads > 0 ? (pthread_t*) malloc(sizeof(pthread_t) * threads) : NULL;
+    for(int i = 0; i < threads; i++) {
+        if(pthread_create(&pool->threads[i], NULL, poolWorker, pool) != 0) {
+            break;
+        }
+        pool->threadCount++;
+    }
+
+    return pool;
+}
+
+// Stop workers and free pool
+void destroyThreadPool(ThreadPool* pool) {
+    if(!pool) {
+        return;
+    }
+
+    // Wake everyone up to leave
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->workReady);
+    pthread_mutex_unlock(&pool->lock);
+
+    for(int i = 0; i < pool->threadCount; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->workDone);
+    pthread_cond_destroy(&pool->workReady);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool);
+}
+
+// Workers for a pool that uses every core
+int defaultPoolThreads(void) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    // Calling thread works as well, so one less worker
+    return cores > 1 ? (int)cores - 1 : 0;
+}
+
+// Worker loop
+void* poolWorker(void* arg) {
+    ThreadPool* pool = (ThreadPool*) arg;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while(1) {
+        // Sleep until a new job or shutdown
+        while(!pool->shutdown && pool->generation == seen) {
+            pthread_cond_wait(&pool->workReady, &pool->lock);
+        }
+        if(pool->shutdown) {
+            break;
+        }
+        seen = pool->generation;
+        runPoolChunks(pool);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+// Run chunks until job exhausted
+void runPoolChunks(ThreadPool* pool) {
+    while(pool->nextChunk < pool->chunkCount) {
+        // Claim a chunk
+        int chunk = pool->nextChunk++;
+        pthread_mutex_unlock(&pool->lock);
+
+        int begin = chunk * pool->chunkSize;
+        int end = begin + pool->chunkSize;
+        if(end > pool->ownerCount) {
+            end = pool->ownerCount;
+        }
+        pool->task(pool->owners, begin, end, pool->ctx, pool->results + (size_t)chunk * pool->resultSize);
+
+        // Report chunk done
+        pthread_mutex_lock(&pool->lock);
+        pool->pendingChunks--;
+        if(pool->pendingChunks == 0) {
+            pthread_cond_broadcast(&pool->workDone);
+        }
+    }
+}
+
+// Split owners into chunks and run task on all of them
+void* parallelForOwners(ThreadPool* pool, OwnerNode** owners, int count, OwnerChunkTask task,
+                        void* ctx, size_t resultSize, int* chunkCount) {
+    // A few chunks per thread to even out unequal Pokedex sizes
+    int chunks = (pool->threadCount + 1) * 4;
+    if(chunks > count) {
+        chunks = count;
+    }
+    if(chunks < 1) {
+        chunks = 1;
+    }
+    int chunkSize = (count + chunks - 1) / chunks;
+    if(chunkSize < 1) {
+        chunkSize = 1;
+    }
+    chunks = (count + chunkSize - 1) / chunkSize;
+
+    char* results = (char*) calloc(chunks > 0 ? chunks : 1, resultSize);
+    *chunkCount = chunks;
+    if(count == 0) {
+        return results;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    // One job at a time
+    while(pool->busy) {
+        pthread_cond_wait(&pool->workDone, &pool->lock);
+    }
+    pool->busy = 1;
+
+    // Post the job
+    pool->task = task;
+    pool->owners = owners;
+    pool->ownerCount = count;
+    pool->ctx = ctx;
+    pool->results = results;
+    pool->resultSize = resultSize;
+    pool->chunkSize = chunkSize;
+    pool->chunkCount = chunks;
+    pool->nextChunk = 0;
+    pool->pendingChunks = chunks;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->workReady);
+
+    // Join in, then wait for the rest
+    runPoolChunks(pool);
+    while(pool->pendingChunks > 0) {
+        pthread_cond_wait(&pool->workDone, &pool->lock);
+    }
+    pool->busy = 0;
+    pthread_cond_broadcast(&pool->workDone);
+    pthread_mutex_unlock(&pool->lock);
+
+    return results;
+}
+
+// Flatten owners ring to array
+OwnerNode** collectOwners(Registry* reg, int* count) {
+    *count = 0;
+    if(!reg->head) {
+        return NULL;
+    }
+
+    // Count owners
+    OwnerNode* owner = reg->head;
+    do {
+        (*count)++;
+        owner = owner->next;
+    } while(owner != reg->head);
+
+    // Copy pointers
+    OwnerNode** owners = (OwnerNode**) malloc(sizeof(OwnerNode*) * (*count));
+    for(int i = 0; i < *count; i++) {
+        owners[i] = owner;
+        owner = owner->next;
+    }
+
+    return owners;
+}
+
+// Add tree data to stats
+int accumulateTreeStats(PokemonNode* root, RegistryStats* stats) {
+    if(!root) {
+        return 0;
+    }
+    PokemonData* data = root->data;
+    stats->totalHp += data->hp;
+    stats->totalAttack += data->attack;
+    stats->totalStrength += (data->attack * 1.5) + (data->hp * 1.2);
+    if(data->TYPE >= 0 && data->TYPE < TYPE_COUNT) {
+        stats->typeCount[data->TYPE]++;
+    }
+
+    return 1 + accumulateTreeStats(root->left, stats) + accumulateTreeStats(root->right, stats);
+}
+
+// Check BST ordering
+int isValidBST(PokemonNode* root, long low, long high) {
+    if(!root) {
+        return 1;
+    }
+    long id = root->data->id;
+    if(id <= low || id >= high) {
+        return 0;
+    }
+
+    return isValidBST(root->left, low, id) && isValidBST(root->right, id, high);
+}
+
+// Stats for a chunk of owners
+void statsChunkTask(OwnerNode** owners, int begin, int end, void* ctx, void* result) {
+    (void) ctx;
+    RegistryStats* stats = (RegistryStats*) result;
+
+    for(int i = begin; i < end; i++) {
+        pthread_mutex_lock(&owners[i]->lock);
+        int size = accumulateTreeStats(owners[i]->pokedexRoot, stats);
+        pthread_mutex_unlock(&owners[i]->lock);
+        stats->pokemon += size;
+        stats->owners++;
+        if(size > stats->largestDex) {
+            stats->largestDex = size;
+        }
+    }
+}
+
+// Invariant check for a chunk of owners
+void invariantChunkTask(OwnerNode** owners, int begin, int end, void* ctx, void* result) {
+    int* verdicts = (int*) ctx;
+    InvariantResult* check = (InvariantResult*) result;
+
+    for(int i = begin; i < end; i++) {
+        pthread_mutex_lock(&owners[i]->lock);
+        verdicts[i] = isValidBST(owners[i]->pokedexRoot, (long)INT_MIN - 1, (long)INT_MAX + 1);
+        pthread_mutex_unlock(&owners[i]->lock);
+        check->checked++;
+        if(!verdicts[i]) {
+            check->broken++;
+        }
+    }
+}
+
+// Free a chunk of owners already detached from the ring
+void teardownChunkTask(OwnerNode** owners, int begin, int end, void* ctx, void* result) {
+    (void) ctx;
+    (void) result;
+
+    for(int i = begin; i < end; i++) {
+        destroyOwner(owners[i]);
+    }
+}
+
+// Gather registry wide stats
+void computeRegistryStats(Registry* reg, RegistryStats* stats) {
+    memset(stats, 0, sizeof(RegistryStats));
+
+    int count, chunks;
+    OwnerNode** owners = collectOwners(reg, &count);
+    RegistryStats* partial = (RegistryStats*) parallelForOwners(reg->pool, owners, count,
+                                                                statsChunkTask, NULL, sizeof(RegistryStats), &chunks);
+
+    // Reduce chunk results
+    for(int i = 0; i < chunks; i++) {
+        stats->owners += partial[i].owners;
+        stats->pokemon += partial[i].pokemon;
+        stats->totalHp += partial[i].totalHp;
+        stats->totalAttack += partial[i].totalAttack;
+        stats->totalStrength += partial[i].totalStrength;
+        if(partial[i].largestDex > stats->largestDex) {
+            stats->largestDex = partial[i].largestDex;
+        }
+        for(int t = 0; t < TYPE_COUNT; t++) {
+            stats->typeCount[t] += partial[i].typeCount[t];
+        }
+    }
+
+    free(partial);
+    free(owners);
+}
+
+// Print registry wide stats
+void printRegistryStats(Registry* reg) {
+    pthread_rwlock_rdlock(&reg->lock);
+    // Validate owners exist
+    if(!reg->head) {
+        pthread_rwlock_unlock(&reg->lock);
+        printf("No owners.\n");
+        return;
+    }
+
+    RegistryStats stats;
+    computeRegistryStats(reg, &stats);
+    pthread_rwlock_unlock(&reg->lock);
+
+    printf("\n=== Registry Statistics ===\n");
+    printf("Owners: %d\n", stats.owners);
+    printf("Pokemon: %ld\n", stats.pokemon);
+    printf("Largest Pokedex: %d\n", stats.largestDex);
+    printf("Average Pokedex: %.2f\n", (double)stats.pokemon / stats.owners);
+    printf("Total HP: %ld, Total Attack: %ld\n", stats.totalHp, stats.totalAttack);
+    printf("Total Strength: %.2f\n", stats.totalStrength);
+    printf("Types:\n");
+    for(int t = 0; t < TYPE_COUNT; t++) {
+        if(stats.typeCount[t]) {
+            printf("%s: %ld\n", getTypeName((PokemonType)t), stats.typeCount[t]);
+        }
+    }
+}
+
+// Check all pokedexes are valid BSTs
+void validateAllPokedexes(Registry* reg) {
+    pthread_rwlock_rdlock(&reg->lock);
+    // Validate owners exist
+    if(!reg->head) {
+        pthread_rwlock_unlock(&reg->lock);
+        printf("No owners.\n");
+        return;
+    }
+
+    int count, chunks;
+    OwnerNode** owners = collectOwners(reg, &count);
+    int* verdicts = (int*) malloc(sizeof(int) * count);
+    InvariantResult* partial = (InvariantResult*) parallelForOwners(reg->pool, owners, count,
+                                                                    invariantChunkTask, verdicts,
+                                                                    sizeof(InvariantResult), &chunks);
+
+    int checked = 0, broken = 0;
+    for(int i = 0; i < chunks; i++) {
+        checked += partial[i].checked;
+        broken += partial[i].broken;
+    }
+    // Report broken owners in ring order
+    for(int i = 0; i < count; i++) {
+        if(!verdicts[i]) {
+            printf("Pokedex of %s is not a valid BST.\n", owners[i]->ownerName);
+        }
+    }
+    printf("Checked %d Pokedexes, %d broken.\n", checked, broken);
+    pthread_rwlock_unlock(&reg->lock);
+
+    free(partial);
+    free(verdicts);
+    free(owners);
+}
+
+// SERVER FUNCTIONS
+// Set by the signal handler to stop the event loop
+static volatile sig_atomic_t serverStop = 0;
+// Connection that serverPrintData writes to
+static Connection* serverOut = NULL;
+// All live connections
+static Connection* serverConnections = NULL;
+// Directory export and typestats files live in, NULL turns them off
+static const char* serverFileDir = NULL;
+
+// Stop server on signal
+static void serverSignal(int sig) {
+    (void) sig;
+    serverStop = 1;
+}
+
+// Make fd non blocking
+static int setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// Grow a byte buffer to hold at least need bytes
+static void growBuffer(char** buffer, size_t* cap, size_t need) {
+    if(*cap >= need) {
+        return;
+    }
+    size_t newCap = *cap ? *cap : SERVER_READ_CHUNK;
+    while(newCap < need) {
+        newCap *= 2;
+    }
+    *buffer = (char*) realloc(*buffer, newCap);
+    *cap = newCap;
+}
+
+// Append formatted text to connection output
+void connPrintf(Connection* conn, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if(len < 0) {
+        return;
+    }
+
+    growBuffer(&conn->out, &conn->outCap, conn->outLen + len + 1);
+    va_start(args, format);
+    vsnprintf(conn->out + conn->outLen, len + 1, format, args);
+    va_end(args);
+    conn->outLen += len;
+}
+
+// Print Pokemon to current connection
+void serverPrintData(const PokemonData* data) {
+    connPrintf(serverOut, "ID: %d, Name: %s, Type: %s, HP: %d, Attack: %d, Can Evolve: %s\n",
+               data->id,
+               data->name,
+               getTypeName(data->TYPE),
+               data->hp,
+               data->attack,
+               (data->CAN_EVOLVE == CAN_EVOLVE) ? "Yes" : "No");
+}
+
+// Parse a positive int token
+static int parseIntToken(const char* token, int* value) {
+    if(!token) {
+        return 0;
+    }
+    char* end;
+    long parsed = strtol(token, &end, 10);
+    if(*end != '\0' || end == token || parsed < INT_MIN || parsed > INT_MAX) {
+        return 0;
+    }
+    *value = (int)parsed;
+    return 1;
+}
+
+// Parse an ID or a species name
+static int parseSpeciesToken(const char* token, int* id) {
+    if(parseIntToken(token, id)) {
+        return 1;
+    }
+    *id = findSpeciesByName(token);
+    return *id != 0;
+}
+
+// Valid Pokemon ID for the active catalog
+static int validPokemonId(int id) {
+    return getSpecies(id) != NULL;
+}
+
+// Print an owner's pokedex in the given order into the connection
+static void serverDisplay(Registry* reg, Connection* conn, const char* name, const char* order) {
+    static const char* orders[] = {"bfs", "pre", "in", "post", "alpha"};
+    int choice = 0;
+    for(int i = 0; i < 5; i++) {
+        if(strcmp(order, orders[i]) == 0) {
+            choice = i + 1;
+        }
+    }
+    if(!choice) {
+        connPrintf(conn, "ERR unknown order\n");
+        return;
+    }
+
+    pthread_rwlock_rdlock(&reg->lock);
+    OwnerNode* owner = findOwnerByName(reg, name);
+    FrozenPokedex* frozen = owner && choice == 1 ? acquireFrozen(owner) : NULL;
+    PersistentNode* snapshot = owner && !frozen ? acquirePokedexSnapshot(owner) : NULL;
+    pthread_rwlock_unlock(&reg->lock);
+    if(!owner) {
+        connPrintf(conn, "ERR no such owner\n");
+        return;
+    }
+
+    // Frozen Pokedex prints BFS straight from its array
+    if(frozen) {
+        serverOut = conn;
+        frozenScanBFS(frozen, serverPrintData);
+        serverOut = NULL;
+        releaseFrozen(frozen);
+        connPrintf(conn, "OK\n");
+        return;
+    }
+
+    // Walk the pinned version without any lock
+    if(!snapshot) {
+        connPrintf(conn, "Pokedex is empty.\n");
+    }
+    serverOut = conn;
+    displaySnapshot(snapshot, choice, serverPrintData);
+    serverOut = NULL;
+    releasePersistent(snapshot);
+
+    connPrintf(conn, "OK\n");
+}
+
+// Show or release an ID range of a named owner
+static void serverRangeCommand(Registry* reg, Connection* conn, const char* cmd, char** args, int argc) {
+    int low, high;
+    if(argc < 3 || !parseSpeciesToken(args[1], &low) || !parseSpeciesToken(args[2], &high)) {
+        connPrintf(conn, "ERR bad arguments\n");
+        return;
+    }
+
+    pthread_rwlock_rdlock(&reg->lock);
+    OwnerNode* owner = findOwnerByName(reg, args[0]);
+    if(!owner) {
+        pthread_rwlock_unlock(&reg->lock);
+        connPrintf(conn, "ERR no such owner\n");
+        return;
+    }
+
+    if(strcmp(cmd, "range") == 0) {
+        PersistentNode* snapshot = acquirePokedexSnapshot(owner);
+        pthread_rwlock_unlock(&reg->lock);
+        serverOut = conn;
+        snapshotRange(snapshot, low, high, serverPrintData);
+        serverOut = NULL;
+        releasePersistent(snapshot);
+        connPrintf(conn, "OK\n");
+        return;
+    }
+
+    int released;
+    OpStatus status = ownerReleaseRange(owner, low, high, &released);
+    pthread_rwlock_unlock(&reg->lock);
+    if(status == OP_OK) {
+        connPrintf(conn, "Released %d Pokemon with IDs %d to %d.\nOK\n", released, low, high);
+    } else {
+        connPrintf(conn, status == OP_INVALID ? "ERR bad range\n" : (status == OP_EMPTY ? "ERR Pokedex empty\n" : "ERR not found\n"));
+    }
+}
+
+// Tree health, rebalance and auto-rebalance of a named owner
+static void serverHealthCommand(Registry* reg, Connection* conn, const char* cmd, char** args, int argc) {
+    int depth = 0;
+    if(argc < 1 || (strcmp(cmd, "autorebalance") == 0 && (argc < 2 || !parseIntToken(args[1], &depth)))) {
+        connPrintf(conn, "ERR bad arguments\n");
+        return;
+    }
+
+    pthread_rwlock_rdlock(&reg->lock);
+    OwnerNode* owner = findOwnerByName(reg, args[0]);
+    if(!owner) {
+        pthread_rwlock_unlock(&reg->lock);
+        connPrintf(conn, "ERR no such owner\n");
+        return;
+    }
+
+    if(strcmp(cmd, "health") == 0) {
+        TreeHealth health;
+        PersistentNode* snapshot = acquirePokedexSnapshot(owner);
+        FrozenPokedex* frozen = acquireFrozen(owner);
+        pthread_rwlock_unlock(&reg->lock);
+        computeTreeHealth(snapshot, &health);
+        releasePersistent(snapshot);
+        connPrintf(conn, "count %d height %d maxdepth %d avgdepth %.2f imbalance %.2f bytes %zu frozen %zu\nOK\n",
+                   health.count, health.height, health.maxDepth, health.avgDepth, health.imbalance,
+                   pointerNodeBytes(health.count), frozenPoolBytes(frozen));
+        releaseFrozen(frozen);
+    } else if(strcmp(cmd, "rebalance") == 0) {
+        OpStatus status = ownerRebalance(owner);
+        pthread_rwlock_unlock(&reg->lock);
+        connPrintf(conn, status == OP_OK ? "OK\n" : "ERR Pokedex empty\n");
+    } else {
+        pthread_mutex_lock(&owner->lock);
+        owner->rebalanceDepth = depth > 0 ? depth : 0;
+        pthread_mutex_unlock(&owner->lock);
+        pthread_rwlock_unlock(&reg->lock);
+        connPrintf(conn, "OK\n");
+    }
+}
+
+// Run a Pokedex command on a named owner
+static void serverOwnerCommand(Registry* reg, Connection* conn, const char* cmd, char** args, int argc) {
+    int id1 = 0, id2 = 0;
+    if(argc < 2 || !parseSpeciesToken(args[1], &id1) || !validPokemonId(id1)
+       || (strcmp(cmd, "fight") == 0 && (argc < 3 || !parseSpeciesToken(args[2], &id2)))) {
+        connPrintf(conn, "ERR bad arguments\n");
+        return;
+    }
+
+    pthread_rwlock_rdlock(&reg->lock);
+    OwnerNode* owner = findOwnerByName(reg, args[0]);
+    if(!owner) {
+        pthread_rwlock_unlock(&reg->lock);
+        connPrintf(conn, "ERR no such owner\n");
+        return;
+    }
+
+    OpStatus status;
+    if(strcmp(cmd, "add") == 0) {
+        status = ownerAddPokemon(owner, id1);
+        if(status == OP_OK) {
+            connPrintf(conn, "Pokemon %s (ID %d) added.\n", getSpecies(id1)->name, id1);
+        }
+    } else if(strcmp(cmd, "release") == 0) {
+        status = ownerReleasePokemon(owner, id1);
+        if(status == OP_OK) {
+            connPrintf(conn, "Removing Pokemon %s (ID %d).\n", getSpecies(id1)->name, id1);
+        }
+    } else if(strcmp(cmd, "evolve") == 0) {
+        PokemonData before, after;
+        status = ownerEvolvePokemon(owner, id1, &before, &after);
+        if(status == OP_DUPLICATE) {
+            // Same message as the menu, the count went down by one
+            connPrintf(conn, "Evolution ID %d (%s) already in the Pokedex. Releasing %s (ID %d).\n",
+                       after.id, after.name, before.name, before.id);
+            status = OP_OK;
+        } else if(status == OP_OK) {
+            connPrintf(conn, "Pokemon evolved from %s (ID %d) to %s (ID %d).\n", before.name, before.id, after.name, after.id);
+        }
+    } else {
+        FightResult result;
+        status = ownerFight(owner, id1, id2, &result);
+        if(status == OP_OK) {
+            connPrintf(conn, "Pokemon 1: %s (Score = %.2f)\n", result.first.name, result.score1);
+            connPrintf(conn, "Pokemon 2: %s (Score = %.2f)\n", result.second.name, result.score2);
+            if(result.winner) {
+                connPrintf(conn, "%s wins!\n", result.winner == 1 ? result.first.name : result.second.name);
+            } else {
+                connPrintf(conn, "It's a tie!\n");
+            }
+        }
+    }
+    pthread_rwlock_unlock(&reg->lock);
+
+    switch(status) {
+    case OP_OK:
+        connPrintf(conn, "OK\n");
+        break;
+    case OP_DUPLICATE:
+        connPrintf(conn, "ERR already in Pokedex\n");
+        break;
+    case OP_EMPTY:
+        connPrintf(conn, "ERR Pokedex empty\n");
+        break;
+    case OP_CANNOT_EVOLVE:
+        connPrintf(conn, "ERR cannot evolve\n");
+        break;
+    default:
+        connPrintf(conn, "ERR not found\n");
+    }
+}
+
+// Chunk sink appending to the connection output
+static void connWriteChunk(void* ctx, const char* data, size_t len) {
+    Connection* conn = (Connection*) ctx;
+    growBuffer(&conn->out, &conn->outCap, conn->outLen + len + 1);
+    memcpy(conn->out + conn->outLen, data, len);
+    conn->outLen += len;
+}
+
+// Print owners in a direction into the connection
+static void serverPrintOwners(Registry* reg, Connection* conn, const char* direction, const char* countToken) {
+    int prints;
+    if(!direction || !parseIntToken(countToken, &prints) || prints > SERVER_MAX_PRINTS
+       || (direction[0] != 'f' && direction[0] != 'F' && direction[0] != 'b' && direction[0] != 'B')) {
+        connPrintf(conn, "ERR bad arguments\n");
+        return;
+    }
+    int forward = direction[0] == 'f' || direction[0] == 'F';
+
+    streamOwnersCircular(reg, forward, prints, connWriteChunk, conn);
+    connPrintf(conn, "OK\n");
+}
+
+// Export columns, or aggregate them live or from a file
+static void serverColumnsCommand(Registry* reg, Connection* conn, const char* cmd, char** args, int argc) {
+    // Clients only name plain files inside the file directory
+    char path[SERVER_MAX_LINE];
+    if(argc > 0) {
+        if(!serverFileDir) {
+            connPrintf(conn, "ERR file access is off\n");
+            return;
+        }
+        if(args[0][0] == '.' || strchr(args[0], '/')
+           || snprintf(path, sizeof(path), "%s/%s", serverFileDir, args[0]) >= (int)sizeof(path)) {
+            connPrintf(conn, "ERR bad file name\n");
+            return;
+        }
+    }
+
+    PokedexColumns columns;
+    if(strcmp(cmd, "export") == 0) {
+        if(argc < 1) {
+            connPrintf(conn, "ERR bad arguments\n");
+            return;
+        }
+        buildPokedexColumns(reg, &columns);
+        int ok = exportPokedexColumns(&columns, path);
+        connPrintf(conn, ok ? "Exported %d Pokemon.\nOK\n" : "ERR cannot write file\n", columns.rows);
+        freePokedexColumns(&columns);
+        return;
+    }
+
+    if(argc > 0) {
+        if(!loadPokedexColumns(path, &columns)) {
+            connPrintf(conn, "ERR cannot load file\n");
+            return;
+        }
+    } else {
+        buildPokedexColumns(reg, &columns);
+    }
+    if(columns.rows > 0) {
+        ColumnAggregates result;
+        aggregatePokedexColumns(&columns, &result);
+        writeColumnAggregates(&result, columns.rows, connWriteChunk, conn);
+    }
+    connPrintf(conn, "OK\n");
+    freePokedexColumns(&columns);
+}
+
+// Page, select or rank on a pinned version of a named owner
+static void serverOrderCommand(Registry* reg, Connection* conn, const char* cmd, char** args, int argc) {
+    int first, count = 1;
+    int paged = strcmp(cmd, "page") == 0;
+    int valid = strcmp(cmd, "rank") == 0 ? argc >= 2 && parseSpeciesToken(args[1], &first)
+                                         : argc >= 2 && parseIntToken(args[1], &first);
+    if(!valid || (paged && (argc < 3 || !parseIntToken(args[2], &count)))) {
+        connPrintf(conn, "ERR bad arguments\n");
+        return;
+    }
+
+    pthread_rwlock_rdlock(&reg->lock);
+    OwnerNode* owner = findOwnerByName(reg, args[0]);
+    PersistentNode* snapshot = owner ? acquirePokedexSnapshot(owner) : NULL;
+    pthread_rwlock_unlock(&reg->lock);
+    if(!owner) {
+        connPrintf(conn, "ERR no such owner\n");
+        return;
+    }
+
+    if(strcmp(cmd, "rank") == 0) {
+        int rank = snapshotRank(snapshot, first);
+        connPrintf(conn, rank ? "Rank %d of %d.\nOK\n" : "ERR not found\n", rank, snapshot ? snapshot->size : 0);
+    } else {
+        // nth is a page of one
+        serverOut = conn;
+        int shown = snapshotPage(snapshot, first, count, serverPrintData);
+        serverOut = NULL;
+        connPrintf(conn, shown || paged ? "OK\n" : "ERR no such position\n");
+    }
+    releasePersistent(snapshot);
+}
+
+// Set operation between two named owners
+static void serverCompareCommand(Registry* reg, Connection* conn, char** args, int argc) {
+    static const char* ops[] = {"both", "only", "xor"};
+    int op = -1;
+    for(int i = 0; i < 3 && argc >= 3; i++) {
+        if(strcmp(args[2], ops[i]) == 0) {
+            op = i;
+        }
+    }
+    if(op < 0) {
+        connPrintf(conn, "ERR bad arguments\n");
+        return;
+    }
+
+    int count;
+    serverOut = conn;
+    OpStatus status = registryCompareOwners(reg, args[0], args[1], (SetOperation)op, serverPrintData, &count);
+    serverOut = NULL;
+    connPrintf(conn, status == OP_OK ? "%d Pokemon.\nOK\n" : "ERR no such owner\n", count);
+}
+
+// Print running totals of a named owner
+static void serverSummaryCommand(Registry* reg, Connection* conn, char** args, int argc) {
+    PokedexTotals totals;
+    int maxAttack = 0;
+    pthread_rwlock_rdlock(&reg->lock);
+    OwnerNode* owner = argc > 0 ? findOwnerByName(reg, args[0]) : NULL;
+    if(owner) {
+        ownerPokedexSummary(owner, &totals, &maxAttack);
+    }
+    pthread_rwlock_unlock(&reg->lock);
+    if(!owner) {
+        connPrintf(conn, "ERR no such owner\n");
+        return;
+    }
+
+    connPrintf(conn, "Pokemon: %d\nTotal HP: %lld, Total Attack: %lld\nMax Attack: %d\n",
+               totals.count, totals.hpSum, totals.attackSum, maxAttack);
+    for(int t = 0; t < TYPE_COUNT; t++) {
+        if(totals.typeCount[t]) {
+            connPrintf(conn, "%s: %d\n", getTypeName((PokemonType)t), totals.typeCount[t]);
+        }
+    }
+    connPrintf(conn, "OK\n");
+}
+
+// Best counters in a named owner against a species
+static void serverCounterCommand(Registry* reg, Connection* conn, char** args, int argc) {
+    int id, k = 3;
+    if(argc < 2 || !parseSpeciesToken(args[1], &id) || !getSpecies(id)
+       || (argc > 2 && (!parseIntToken(args[2], &k) || k < 1 || k > COUNTER_MAX))) {
+        connPrintf(conn, "ERR bad arguments\n");
+        return;
+    }
+
+    pthread_rwlock_rdlock(&reg->lock);
+    OwnerNode* owner = findOwnerByName(reg, args[0]);
+    CounterIndex* index = owner ? acquireCounterIndex(owner) : NULL;
+    pthread_rwlock_unlock(&reg->lock);
+    if(!owner) {
+        connPrintf(conn, "ERR no such owner\n");
+        return;
+    }
+
+    CounterPick picks[COUNTER_MAX];
+    int found = bestCounters(index, getSpecies(id), picks, k, NULL);
+    releaseCounterIndex(index);
+    for(int i = 0; i < found; i++) {
+        connPrintf(conn, "%d. %s (ID %d, %s) Score = %.2f\n", i + 1, picks[i].data.name, picks[i].data.id,
+                   getTypeName(picks[i].data.TYPE), picks[i].score);
+    }
+    connPrintf(conn, found ? "OK\n" : "ERR Pokedex empty\n");
+}
+
+// Best team of a named owner under a type limit and types to cover
+static void serverTeamCommand(Registry* reg, Connection* conn, char** args, int argc) {
+    TeamConstraints constraints = {0, 0};
+    int known = argc >= 1 && (argc < 2 || parseIntToken(args[1], &constraints.maxPerType));
+    for(int i = 2; i < argc && known; i++) {
+        known = addCoverTypes(args[i], &constraints.coverMask);
+    }
+    if(!known || constraints.maxPerType < 0) {
+        connPrintf(conn, "ERR bad arguments\n");
+        return;
+    }
+
+    TeamResult team;
+    OpStatus status = registryBestTeam(reg, args[0], &constraints, &team);
+    if(status != OP_OK) {
+        connPrintf(conn, status == OP_NOT_FOUND ? "ERR no such owner\n"
+                   : status == OP_EMPTY ? "ERR Pokedex empty\n" : "ERR no team meets the constraints\n");
+        return;
+    }
+    for(int i = 0; i < team.size; i++) {
+        connPrintf(conn, "%d. %s (ID %d, %s)\n", i + 1, team.members[i].name, team.members[i].id,
+                   getTypeName(team.members[i].TYPE));
+    }
+    connPrintf(conn, "Score %.2f, searched %ld.\nOK\n", team.score, team.nodes);
+}
+
+// Run a query glued back together from its tokens
+static void serverQueryCommand(Registry* reg, Connection* conn, char** args, int argc) {
+    // Tokens came from one line, so they fit back into one
+    char text[SERVER_MAX_LINE];
+    size_t length = 0;
+    text[0] = '\0';
+    for(int i = 0; i < argc; i++) {
+        length += snprintf(text + length, sizeof(text) - length, i > 0 ? " %s" : "%s", args[i]);
+    }
+
+    PokemonQuery query;
+    if(!parsePokemonQuery(text, &query)) {
+        connPrintf(conn, "ERR bad query\n");
+        return;
+    }
+    int rows;
+    if(runPokemonQuery(reg, &query, connWriteChunk, conn, &rows) != OP_OK) {
+        connPrintf(conn, "ERR no such owner\n");
+        return;
+    }
+    connPrintf(conn, "%d rows.\nOK\n", rows);
+}
+
+// Handle one protocol line
+void serverHandleLine(Registry* reg, Connection* conn, char* line) {
+    char* args[SERVER_MAX_ARGS] = {NULL};
+    char* save = NULL;
+    char* cmd = strtok_r(line, " \t\r", &save);
+    int argc = 0;
+    char* token;
+    while(argc < SERVER_MAX_ARGS && (token = strtok_r(NULL, " \t\r", &save))) {
+        args[argc++] = token;
+    }
+
+    // Empty line, nothing to answer
+    if(!cmd) {
+        return;
+    }
+    if(argc == SERVER_MAX_ARGS && strtok_r(NULL, " \t\r", &save)) {
+        connPrintf(conn, "ERR too many arguments\n");
+        return;
+    }
+    profileOperation(cmd);
+
+    if(strcmp(cmd, "add") == 0 || strcmp(cmd, "release") == 0
+       || strcmp(cmd, "evolve") == 0 || strcmp(cmd, "fight") == 0) {
+        serverOwnerCommand(reg, conn, cmd, args, argc);
+    } else if(strcmp(cmd, "open") == 0) {
+        int starter;
+        if(argc < 2 || !parseIntToken(args[1], &starter)) {
+            connPrintf(conn, "ERR bad arguments\n");
+            return;
+        }
+        OpStatus status = registryOpenOwner(reg, args[0], starter);
+        connPrintf(conn, status == OP_OK ? "OK\n" : (status == OP_DUPLICATE ? "ERR owner exists\n" : "ERR bad starter\n"));
+    } else if(strcmp(cmd, "evolveall") == 0) {
+        if(argc < 1) {
+            connPrintf(conn, "ERR bad arguments\n");
+            return;
+        }
+        pthread_rwlock_rdlock(&reg->lock);
+        OwnerNode* owner = findOwnerByName(reg, args[0]);
+        int evolved = 0, released = 0;
+        OpStatus status = owner ? ownerEvolveAll(owner, argc > 1 && strcmp(args[1], "final") == 0, &evolved, &released) : OP_NOT_FOUND;
+        pthread_rwlock_unlock(&reg->lock);
+        if(status == OP_OK) {
+            connPrintf(conn, "Evolved %d Pokemon, released %d duplicates.\nOK\n", evolved, released);
+        } else {
+            connPrintf(conn, status == OP_EMPTY ? "ERR Pokedex empty\n" : "ERR no such owner\n");
+        }
+    } else if(strcmp(cmd, "range") == 0 || strcmp(cmd, "releaserange") == 0) {
+        serverRangeCommand(reg, conn, cmd, args, argc);
+    } else if(strcmp(cmd, "health") == 0 || strcmp(cmd, "rebalance") == 0 || strcmp(cmd, "autorebalance") == 0) {
+        serverHealthCommand(reg, conn, cmd, args, argc);
+    } else if(strcmp(cmd, "mergemany") == 0) {
+        int released = 0;
+        OpStatus status = argc >= 2 ? registryMergeMany(reg, args[0], (const char**) args + 1, argc - 1, &released) : OP_INVALID;
+        if(status == OP_OK) {
+            connPrintf(conn, "Merged %d owners into %s, released %d duplicates.\nOK\n", argc - 1, args[0], released);
+        } else {
+            connPrintf(conn, status == OP_NOT_FOUND ? "ERR not found\n" : "ERR bad arguments\n");
+        }
+    } else if(strcmp(cmd, "export") == 0 || strcmp(cmd, "typestats") == 0) {
+        serverColumnsCommand(reg, conn, cmd, args, argc);
+    } else if(strcmp(cmd, "page") == 0 || strcmp(cmd, "nth") == 0 || strcmp(cmd, "rank") == 0) {
+        serverOrderCommand(reg, conn, cmd, args, argc);
+    } else if(strcmp(cmd, "trade") == 0) {
+        int id;
+        if(argc < 3 || !parseSpeciesToken(args[2], &id)) {
+            connPrintf(conn, "ERR bad arguments\n");
+            return;
+        }
+        OpStatus status = registryTradePokemon(reg, args[0], args[1], id);
+        connPrintf(conn, status == OP_OK ? "OK\n" : status == OP_DUPLICATE ? "ERR receiver has it\n"
+                   : status == OP_INVALID ? "ERR same owner\n" : "ERR not found\n");
+    } else if(strcmp(cmd, "compare") == 0) {
+        serverCompareCommand(reg, conn, args, argc);
+    } else if(strcmp(cmd, "team") == 0) {
+        serverTeamCommand(reg, conn, args, argc);
+    } else if(strcmp(cmd, "counter") == 0) {
+        serverCounterCommand(reg, conn, args, argc);
+    } else if(strcmp(cmd, "summary") == 0) {
+        serverSummaryCommand(reg, conn, args, argc);
+    } else if(strcmp(cmd, "query") == 0) {
+        serverQueryCommand(reg, conn, args, argc);
+    } else if(strcmp(cmd, "releasewhere") == 0) {
+        // Filter tokens are glued back into one filter text
+        char text[SERVER_MAX_LINE];
+        PokemonFilter filter;
+        if(argc != 4 || snprintf(text, sizeof(text), "%s %s %s", args[1], args[2], args[3]) < 0
+           || !parsePokemonFilter(text, &filter)) {
+            connPrintf(conn, "ERR bad arguments\n");
+            return;
+        }
+        pthread_rwlock_rdlock(&reg->lock);
+        OwnerNode* owner = findOwnerByName(reg, args[0]);
+        int released = 0;
+        OpStatus status = owner ? ownerReleaseWhere(owner, matchPokemonFilter, &filter, &released) : OP_INVALID;
+        pthread_rwlock_unlock(&reg->lock);
+        if(status == OP_OK || status == OP_NOT_FOUND) {
+            connPrintf(conn, "Released %d Pokemon.\nOK\n", released);
+        } else {
+            connPrintf(conn, status == OP_EMPTY ? "ERR Pokedex empty\n" : "ERR no such owner\n");
+        }
+    } else if(strcmp(cmd, "freeze") == 0) {
+        pthread_rwlock_rdlock(&reg->lock);
+        OwnerNode* owner = argc > 0 ? findOwnerByName(reg, args[0]) : NULL;
+        int count = 0;
+        OpStatus status = owner ? ownerFreezePokedex(owner, &count) : OP_NOT_FOUND;
+        pthread_rwlock_unlock(&reg->lock);
+        if(status == OP_OK) {
+            connPrintf(conn, "Pokedex frozen for fast reads (%d Pokemon).\nOK\n", count);
+        } else {
+            connPrintf(conn, status == OP_EMPTY ? "ERR Pokedex empty\n" : "ERR no such owner\n");
+        }
+    } else if(strcmp(cmd, "display") == 0) {
+        if(argc < 1) {
+            connPrintf(conn, "ERR bad arguments\n");
+            return;
+        }
+        serverDisplay(reg, conn, args[0], argc > 1 ? args[1] : "bfs");
+    } else if(strcmp(cmd, "merge") == 0) {
+        if(argc < 2) {
+            connPrintf(conn, "ERR bad arguments\n");
+            return;
+        }
+        connPrintf(conn, registryMergeOwners(reg, args[0], args[1]) == OP_OK ? "OK\n" : "ERR not found\n");
+    } else if(strcmp(cmd, "sort") == 0) {
+        registrySortOwners(reg);
+        connPrintf(conn, "OK\n");
+    } else if(strcmp(cmd, "print") == 0) {
+        serverPrintOwners(reg, conn, args[0], args[1]);
+    } else if(strcmp(cmd, "quit") == 0) {
+        connPrintf(conn, "OK bye\n");
+        conn->closing = 1;
+    } else {
+        connPrintf(conn, "ERR unknown command\n");
+    }
+}
+
+// Free connection and close socket
+static void closeConnection(int epfd, Connection* conn) {
+    // Unlink from live list
+    if(conn->prev) {
+        conn->prev->next = conn->next;
+    } else {
+        serverConnections = conn->next;
+    }
+    if(conn->next) {
+        conn->next->prev = conn->prev;
+    }
+
+    epoll_ctl(epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    free(conn->in);
+    free(conn->out);
+    free(conn);
+}
+
+// Write pending output, returns -1 on a dead socket
+static int flushConnection(int epfd, Connection* conn) {
+    while(conn->outSent < conn->outLen) {
+        ssize_t sent = send(conn->fd, conn->out + conn->outSent, conn->outLen - conn->outSent, MSG_NOSIGNAL);
+        if(sent < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            if(errno != EAGAIN && errno != EWOULDBLOCK) {
+                return -1;
+            }
+            break;
+        }
+        conn->outSent += (size_t)sent;
+    }
+
+    // All sent, reuse buffer from the start
+    if(conn->outSent == conn->outLen) {
+        conn->outSent = 0;
+        conn->outLen = 0;
+    }
+
+    // Only ask for writability while output is pending
+    struct epoll_event event;
+    event.events = EPOLLIN | (conn->outLen ? EPOLLOUT : 0);
+    event.data.ptr = conn;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, conn->fd, &event);
+
+    return 0;
+}
+
+// Read available bytes and run all complete lines, returns -1 to close
+static int readConnection(Registry* reg, Connection* conn) {
+    int peerClosed = 0;
+    while(1) {
+        growBuffer(&conn->in, &conn->inCap, conn->inLen + SERVER_READ_CHUNK);
+        ssize_t got = recv(conn->fd, conn->in + conn->inLen, conn->inCap - conn->inLen, 0);
+        if(got > 0) {
+            conn->inLen += (size_t)got;
+            continue;
+        }
+        if(got == 0) {
+            peerClosed = 1;
+        } else if(errno == EINTR) {
+            continue;
+        } else if(errno != EAGAIN && errno != EWOULDBLOCK) {
+            return -1;
+        }
+        break;
+    }
+
+    // Run every complete line
+    size_t start = 0;
+    for(size_t i = 0; i < conn->inLen && !conn->closing; i++) {
+        if(conn->in[i] == '\n') {
+            conn->in[i] = '\0';
+            serverHandleLine(reg, conn, conn->in + start);
+            start = i + 1;
+        }
+    }
+    // Keep the partial tail for the next read
+    memmove(conn->in, conn->in + start, conn->inLen - start);
+    conn->inLen -= start;
+
+    if(conn->inLen > SERVER_MAX_LINE) {
+        connPrintf(conn, "ERR line too long\n");
+        conn->closing = 1;
+    }
+    if(peerClosed) {
+        conn->closing = 1;
+    }
+
+    return 0;
+}
+
+// Accept every pending client
+static void acceptClients(int epfd, int listenFd) {
+    while(1) {
+        int fd = accept(listenFd, NULL, NULL);
+        if(fd < 0) {
+            return;
+        }
+        if(setNonBlocking(fd) < 0) {
+            close(fd);
+            continue;
+        }
+
+        Connection* conn = (Connection*) calloc(1, sizeof(Connection));
+        conn->fd = fd;
+
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = conn;
+        if(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            close(fd);
+            free(conn);
+            continue;
+        }
+
+        // Link into live list
+        conn->next = serverConnections;
+        if(serverConnections) {
+            serverConnections->prev = conn;
+        }
+        serverConnections = conn;
+    }
+}
+
+// Serve clients on a unix socket
+int runServer(Registry* reg, const char* path, const char* fileDir) {
+    serverFileDir = fileDir;
+    struct sockaddr_un addr;
+    if(strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long.\n");
+        return 1;
+    }
+
+    // Create listening socket
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listenFd < 0) {
+        perror("socket");
+        return 1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if(bind(listenFd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(listenFd, SOMAXCONN) < 0
+       || setNonBlocking(listenFd) < 0) {
+        perror("bind/listen");
+        close(listenFd);
+        return 1;
+    }
+
+    int epfd = epoll_create1(0);
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;  // NULL marks the listening socket
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listenFd, &event);
+
+    // Stop cleanly on Ctrl+C or kill
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = serverSignal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    fprintf(stderr, "Serving on %s\n", path);
+
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    while(!serverStop) {
+        int ready = epoll_wait(epfd, events, SERVER_MAX_EVENTS, -1);
+        if(ready < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            break;
+        }
+
+        for(int i = 0; i < ready; i++) {
+            Connection* conn = (Connection*) events[i].data.ptr;
+            if(!conn) {
+                acceptClients(epfd, listenFd);
+                continue;
+            }
+
+            int dead = 0;
+            if(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                dead = readConnection(reg, conn) < 0;
+            }
+            if(!dead) {
+                dead = flushConnection(epfd, conn) < 0;
+            }
+            // Close once nothing is left to say
+            if(dead || (conn->closing && conn->outLen == 0)) {
+                closeConnection(epfd, conn);
+            }
+        }
+    }
+
+    // Drop clients still connected
+    while(serverConnections) {
+        closeConnection(epfd, serverConnections);
+    }
+    close(epfd);
+    close(listenFd);
+    unlink(path);
+    fprintf(stderr, "Server stopped.\n");
+
+    return 0;
+}
+
+
+// LOAD GENERATOR FUNCTIONS
+typedef struct LoadClient {
+    const char* path;
+    int index;
+    int requests;
+    double* latencies;       // Microseconds per request
+    int completed;
+    int errors;
+} LoadClient;
+
+// Monotonic time in microseconds
+static double nowMicros(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Send a command and read until the final OK/ERR line, returns -1 on IO error, 1 on ERR
+static int loadRequest(int fd, const char* command, char* buffer, size_t cap) {
+    size_t len = strlen(command);
+    size_t sent = 0;
+    while(sent < len) {
+        ssize_t n = send(fd, command + sent, len - sent, MSG_NOSIGNAL);
+        if(n <= 0) {
+            return -1;
+        }
+        sent += (size_t)n;
+    }
+
+    // Read lines until a status line
+    size_t have = 0, lineStart = 0;
+    while(1) {
+        if(have == cap) {
+            // Drop fully read lines to make room
+            memmove(buffer, buffer + lineStart, have - lineStart);
+            have -= lineStart;
+            lineStart = 0;
+            if(have == cap) {
+                return -1;
+            }
+        }
+        ssize_t n = recv(fd, buffer + have, cap - have, 0);
+        if(n <= 0) {
+            return -1;
+        }
+        size_t end = have + (size_t)n;
+        for(size_t i = have; i < end; i++) {
+            if(buffer[i] == '\n') {
+                if(strncmp(buffer + lineStart, "OK", 2) == 0) {
+                    return 0;
+                }
+                if(strncmp(buffer + lineStart, "ERR", 3) == 0) {
+                    return 1;
+                }
+                lineStart = i + 1;
+            }
+        }
+        have = end;
+    }
+}
+
+// One load client thread
+static void* loadClientThread(void* arg) {
+    LoadClient* client = (LoadClient*) arg;
+    char command[SERVER_MAX_LINE];
+    char buffer[SERVER_READ_CHUNK * 4];
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, client->path, sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 || connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        if(fd >= 0) {
+            close(fd);
+        }
+        client->errors = client->requests;
+        return NULL;
+    }
+
+    // Own trainer for this client
+    char owner[64];
+    snprintf(owner, sizeof(owner), "load%ld_%d", (long)getpid(), client->index);
+    snprintf(command, sizeof(command), "open %s %d\n", owner, 1 + client->index % 3);
+    loadRequest(fd, command, buffer, sizeof(buffer));
+
+    // IDs span the active catalog, so start the server with the same one
+    int species = speciesCount();
+    unsigned int seed = (unsigned int)client->index * 2654435761u + 1;
+    for(int r = 0; r < client->requests; r++) {
+        // Cheap LCG for a reproducible mix
+        seed = seed * 1103515245u + 12345u;
+        int id = 1 + (int)((seed >> 8) % (unsigned int)species);
+        switch((seed >> 20) % 10) {
+        case 0:
+        case 1:
+        case 2:
+            snprintf(command, sizeof(command), "add %s %d\n", owner, id);
+            break;
+        case 3:
+            snprintf(command, sizeof(command), "release %s %d\n", owner, id);
+            break;
+        case 4:
+        case 5:
+            snprintf(command, sizeof(command), "fight %s %d %d\n", owner, id, 1 + id % species);
+            break;
+        case 6:
+            snprintf(command, sizeof(command), "evolve %s %d\n", owner, id);
+            break;
+        case 7:
+        case 8:
+            snprintf(command, sizeof(command), "display %s in\n", owner);
+            break;
+        default:
+            snprintf(command, sizeof(command), "print F 5\n");
+        }
+
+        double start = nowMicros();
+        int status = loadRequest(fd, command, buffer, sizeof(buffer));
+        client->latencies[client->completed++] = nowMicros() - start;
+        if(status < 0) {
+            client->errors += client->requests - r;
+            break;
+        }
+    }
+
+    close(fd);
+    return NULL;
+}
+
+// Sort helper for latencies
+static int compareDoubles(const void* a, const void* b) {
+    double x = *(const double*) a, y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+// Run the load generator and print a report
+int runLoadGenerator(const char* path, int clients, int requests) {
+    if(clients < 1 || requests < 1) {
+        fprintf(stderr, "Clients and requests must be positive.\n");
+        return 1;
+    }
+
+    LoadClient* all = (LoadClient*) calloc(clients, sizeof(LoadClient));
+    pthread_t* threads = (pthread_t*) malloc(sizeof(pthread_t) * clients);
+
+    double start = nowMicros();
+    for(int i = 0; i < clients; i++) {
+        all[i].path = path;
+        all[i].index = i;
+        all[i].requests = requests;
+        all[i].latencies = (double*) malloc(sizeof(double) * requests);
+        pthread_create(&threads[i], NULL, loadClientThread, &all[i]);
+    }
+    for(int i = 0; i < clients; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double elapsed = (nowMicros() - start) / 1e6;
+
+    // Gather all latencies
+    long total = 0, errors = 0;
+    for(int i = 0; i < clients; i++) {
+        total += all[i].completed;
+        errors += all[i].errors;
+    }
+    double* latencies = (double*) malloc(sizeof(double) * (total > 0 ? total : 1));
+    long at = 0;
+    for(int i = 0; i < clients; i++) {
+        memcpy(latencies + at, all[i].latencies, sizeof(double) * all[i].completed);
+        at += all[i].completed;
+        free(all[i].latencies);
+    }
+    qsort(latencies, total, sizeof(double), compareDoubles);
+
+    printf("Clients: %d, Requests: %ld, Failed: %ld\n", clients, total, errors);
+    if(total > 0) {
+        printf("Elapsed: %.3f s, Throughput: %.0f req/s\n", elapsed, total / elapsed);
+        printf("Latency p50: %.1f us, p99: %.1f us, max: %.1f us\n",
+               latencies[(total - 1) / 2], latencies[(long)((total - 1) * 0.99)], latencies[total - 1]);
+    }
+
+    free(latencies);
+    free(threads);
+    free(all);
+    return total > 0 ? 0 : 1;
+}
+
+
+// PERSISTENT SNAPSHOT FUNCTIONS
+// Create persistent node, takes over child references
+PersistentNode* createPersistentNode(const PokemonData* data, PersistentNode* left, PersistentNode* right) {
+    PersistentNode* node = (PersistentNode*) malloc(sizeof(PersistentNode));
+    node->data = *data;
+    node->left = left;
+    node->right = right;
+    node->refs = 1;
+
+    // Children are final, so subtree size and maximum are too
+    node->size = 1 + (left ? left->size : 0) + (right ? right->size : 0);
+    node->maxAttack = data->attack;
+    if(left && left->maxAttack > node->maxAttack) {
+        node->maxAttack = left->maxAttack;
+    }
+    if(right && right->maxAttack > node->maxAttack) {
+        node->maxAttack = right->maxAttack;
+    }
+
+    return node;
+}
+
+// Add reference
+PersistentNode* retainPersistent(PersistentNode* node) {
+    if(node) {
+        __atomic_add_fetch(&node->refs, 1, __ATOMIC_RELAXED);
+    }
+    return node;
+}
+
+// Drop reference, free on last one
+void releasePersistent(PersistentNode* node) {
+    if(!node || __atomic_sub_fetch(&node->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    releasePersistent(node->left);
+    releasePersistent(node->right);
+    free(node);
+}
+
+// Insert a copy of data, same path as insertPokemonNode
+PersistentNode* persistentInsert(PersistentNode* root, const PokemonData* data) {
+    PersistentNode* leaf = createPersistentNode(data, NULL, NULL);
+    PersistentNode* version = persistentAttach(root, leaf);
+    releasePersistent(leaf);
+
+    return version;
+}
+
+// Hang subtree at the leaf its root ID leads to, copying only that path
+PersistentNode* persistentAttach(PersistentNode* root, PersistentNode* subtree) {
+    if(!root) {
+        return retainPersistent(subtree);
+    }
+    if(root->data.id > subtree->data.id) {
+        return createPersistentNode(&root->data, persistentAttach(root->left, subtree), retainPersistent(root->right));
+    }
+    return createPersistentNode(&root->data, retainPersistent(root->left), persistentAttach(root->right, subtree));
+}
+
+// Remove ID, copying only the path to it
+PersistentNode* persistentRemove(PersistentNode* root, int id) {
+    if(!root) {
+        return NULL;
+    }
+
+    if(root->data.id == id) {
+        // Right child takes the place, left subtree hangs below it
+        if(root->right) {
+            return root->left ? persistentAttach(root->right, root->left) : retainPersistent(root->right);
+        }
+        return retainPersistent(root->left);
+    }
+
+    if(root->data.id > id) {
+        return createPersistentNode(&root->data, persistentRemove(root->left, id), retainPersistent(root->right));
+    }
+    return createPersistentNode(&root->data, retainPersistent(root->left), persistentRemove(root->right, id));
+}
+
+// Replace data of ID, copying only the path to it
+PersistentNode* persistentReplace(PersistentNode* root, int id, const PokemonData* data) {
+    if(!root) {
+        return NULL;
+    }
+
+    if(root->data.id == id) {
+        return createPersistentNode(data, retainPersistent(root->left), retainPersistent(root->right));
+    }
+    if(root->data.id > id) {
+        return createPersistentNode(&root->data, persistentReplace(root->left, id, data), retainPersistent(root->right));
+    }
+    return createPersistentNode(&root->data, retainPersistent(root->left), persistentReplace(root->right, id, data));
+}
+
+// Copy mutable tree into a fresh version
+PersistentNode* persistentFromTree(PokemonNode* root) {
+    if(!root) {
+        return NULL;
+    }
+
+    return createPersistentNode(root->data, persistentFromTree(root->left), persistentFromTree(root->right));
+}
+
+// Split version at an ID bound
+void persistentSplit(PersistentNode* root, int id, PersistentNode** less, PersistentNode** rest) {
+    if(!root) {
+        *less = NULL;
+        *rest = NULL;
+        return;
+    }
+
+    PersistentNode* part;
+    if(root->data.id < id) {
+        persistentSplit(root->right, id, &part, rest);
+        *less = createPersistentNode(&root->data, retainPersistent(root->left), part);
+    } else {
+        persistentSplit(root->left, id, less, &part);
+        *rest = createPersistentNode(&root->data, part, retainPersistent(root->right));
+    }
+}
+
+// Swap in new version under owner lock
+void publishSnapshot(OwnerNode* owner, PersistentNode* version) {
+    PersistentNode* old = owner->snapshot;
+    owner->snapshot = version;
+    // Readers still holding it keep it alive
+    releasePersistent(old);
+}
+
+// Pin current version
+PersistentNode* acquirePokedexSnapshot(OwnerNode* owner) {
+    pthread_mutex_lock(&owner->lock);
+    PersistentNode* version = retainPersistent(owner->snapshot);
+    pthread_mutex_unlock(&owner->lock);
+
+    return version;
+}
+
+// Visit version in level order
+void snapshotBFS(PersistentNode* root, VisitDataFunc visit) {
+    if(!root) {
+        return;
+    }
+
+    // Array queue, grows as needed
+    int capacity = 16, front = 0, rear = 0;
+    PersistentNode** queue = (PersistentNode**) malloc(sizeof(PersistentNode*) * capacity);
+    queue[rear++] = root;
+
+    while(front < rear) {
+        PersistentNode* current = queue[front++];
+        visit(&current->data);
+        if(rear + 2 > capacity) {
+            capacity *= 2;
+            queue = (PersistentNode**) realloc(queue, sizeof(PersistentNode*) * capacity);
+        }
+        if(current->left) {
+            queue[rear++] = current->left;
+        }
+        if(current->right) {
+            queue[rear++] = current->right;
+        }
+    }
+
+    free(queue);
+}
+
+// Visit version pre order
+void snapshotPreOrder(PersistentNode* root, VisitDataFunc visit) {
+    if(!root) {
+        return;
+    }
+    visit(&root->data);
+    snapshotPreOrder(root->left, visit);
+    snapshotPreOrder(root->right, visit);
+}
+
+// Visit version in order
+void snapshotInOrder(PersistentNode* root, VisitDataFunc visit) {
+    if(!root) {
+        return;
+    }
+    snapshotInOrder(root->left, visit);
+    visit(&root->data);
+    snapshotInOrder(root->right, visit);
+}
+
+// Visit version post order
+void snapshotPostOrder(PersistentNode* root, VisitDataFunc visit) {
+    if(!root) {
+        return;
+    }
+    snapshotPostOrder(root->left, visit);
+    snapshotPostOrder(root->right, visit);
+    visit(&root->data);
+}
+
+// Count nodes of a version
+static int countPersistent(PersistentNode* root) {
+    return root ? root->size : 0;
+}
+
+// Gather data pointers of a version
+static void collectPersistent(PersistentNode* root, const PokemonData** out, int* size) {
+    if(!root) {
+        return;
+    }
+    out[(*size)++] = &root->data;
+    collectPersistent(root->left, out, size);
+    collectPersistent(root->right, out, size);
+}
+
+// Compare data by name for qsort
+static int compareDataByName(const void* a, const void* b) {
+    const PokemonData* x = *(const PokemonData* const*) a;
+    const PokemonData* y = *(const PokemonData* const*) b;
+    return strcmp(x->name, y->name);
+}
+
+// Visit version sorted by name
+void snapshotAlphabetical(PersistentNode* root, VisitDataFunc visit) {
+    int count = countPersistent(root), size = 0;
+    if(count == 0) {
+        return;
+    }
+
+    const PokemonData** all = (const PokemonData**) malloc(sizeof(PokemonData*) * count);
+    collectPersistent(root, all, &size);
+    qsort(all, size, sizeof(PokemonData*), compareDataByName);
+    for(int i = 0; i < size; i++) {
+        visit(all[i]);
+    }
+
+    free(all);
+}
+
+// Display version in chosen order
+int displaySnapshot(PersistentNode* root, int choice, VisitDataFunc visit) {
+    switch (choice) {
+    case 1:
+        snapshotBFS(root, visit);
+        return 1;
+    case 2:
+        snapshotPreOrder(root, visit);
+        return 1;
+    case 3:
+        snapshotInOrder(root, visit);
+        return 1;
+    case 4:
+        snapshotPostOrder(root, visit);
+        return 1;
+    case 5:
+        snapshotAlphabetical(root, visit);
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// Display version in ID range
+int snapshotRange(PersistentNode* root, int low, int high, VisitDataFunc visit) {
+    if(!root) {
+        return 0;
+    }
+
+    // Only go where the range can still be
+    int count = 0;
+    if(root->data.id > low) {
+        count += snapshotRange(root->left, low, high, visit);
+    }
+    if(root->data.id >= low && root->data.id <= high) {
+        visit(&root->data);
+        count++;
+    }
+    if(root->data.id < high) {
+        count += snapshotRange(root->right, low, high, visit);
+    }
+    return count;
+}
+
+// Find k-th smallest ID by subtree sizes
+const PokemonData* snapshotSelect(PersistentNode* root, int k) {
+    PersistentNode* node = root;
+    while(node) {
+        int leftSize = countPersistent(node->left);
+        if(k <= leftSize) {
+            node = node->left;
+        } else if(k == leftSize + 1) {
+            return &node->data;
+        } else {
+            k -= leftSize + 1;
+            node = node->right;
+        }
+    }
+    return NULL;
+}
+
+// Position of ID by subtree sizes
+int snapshotRank(PersistentNode* root, int id) {
+    int before = 0;
+    PersistentNode* node = root;
+    while(node) {
+        if(id < node->data.id) {
+            node = node->left;
+        } else if(id > node->data.id) {
+            before += countPersistent(node->left) + 1;
+            node = node->right;
+        } else {
+            return before + countPersistent(node->left) + 1;
+        }
+    }
+    return 0;
+}
+
+// Visit one page in ID order
+int snapshotPage(PersistentNode* root, int first, int count, VisitDataFunc visit) {
+    if(first < 1 || count < 1 || first > countPersistent(root)) {
+        return 0;
+    }
+
+    // Walk down to position first, keeping the ancestors still to visit
+    int size = 0, capacity = 32;
+    PersistentNode** stack = (PersistentNode**) malloc(sizeof(PersistentNode*) * capacity);
+    PersistentNode* node = root;
+    int skip = first - 1;
+    while(node) {
+        int leftSize = countPersistent(node->left);
+        if(skip > leftSize) {
+            skip -= leftSize + 1;
+            node = node->right;
+            continue;
+        }
+        if(size == capacity) {
+            capacity *= 2;
+            stack = (PersistentNode**) realloc(stack, sizeof(PersistentNode*) * capacity);
+        }
+        stack[size++] = node;
+        node = skip < leftSize ? node->left : NULL;
+    }
+
+    // Plain in-order steps from there
+    int shown = 0;
+    while(shown < count && size > 0) {
+        node = stack[--size];
+        visit(&node->data);
+        shown++;
+        for(node = node->right; node; node = node->left) {
+            if(size == capacity) {
+                capacity *= 2;
+                stack = (PersistentNode**) realloc(stack, sizeof(PersistentNode*) * capacity);
+            }
+            stack[size++] = node;
+        }
+    }
+    free(stack);
+    return shown;
+}
+
+
+// FROZEN POKEDEX FUNCTIONS
+// Collect nodes sorted by ID
+static void collectInOrder(PokemonNode* root, NodeArray* array) {
+    if(!root) {
+        return;
+    }
+    collectInOrder(root->left, array);
+    addNode(array, root);
+    collectInOrder(root->right, array);
+}
+
+// Place sorted nodes at their Eytzinger positions
+static void eytzingerPlace(PokemonNode** sorted, PokemonNode** out, int* next, int k, int count) {
+    if(k > count) {
+        return;
+    }
+    eytzingerPlace(sorted, out, next, 2 * k, count);
+    out[k] = sorted[(*next)++];
+    eytzingerPlace(sorted, out, next, 2 * k + 1, count);
+}
+
+// Build frozen pool and relink tree to match it
+FrozenPokedex* freezeTree(PokemonNode* root, PokemonNode** newRoot) {
+    NodeArray* array = initNodeArray(5);
+    collectInOrder(root, array);
+    int count = array->size;
+
+    FrozenPokedex* frozen = (FrozenPokedex*) malloc(sizeof(FrozenPokedex));
+    frozen->count = count;
+    frozen->pool = (CompactNode*) malloc(sizeof(CompactNode) * (count + 1));
+    frozen->refs = 1;
+
+    // Position k holds what the complete tree has at BFS index k
+    PokemonNode** placed = (PokemonNode**) malloc(sizeof(PokemonNode*) * (count + 1));
+    int next = 0;
+    eytzingerPlace(array->nodes, placed, &next, 1, count);
+
+    for(int k = 1; k <= count; k++) {
+        CompactNode* node = &frozen->pool[k];
+        node->id = (unsigned int)placed[k]->data->id;
+        node->child[0] = 2 * k <= count ? (unsigned int)(2 * k) : 0;
+        node->child[1] = 2 * k + 1 <= count ? (unsigned int)(2 * k + 1) : 0;
+        placed[k]->left = 2 * k <= count ? placed[2 * k] : NULL;
+        placed[k]->right = 2 * k + 1 <= count ? placed[2 * k + 1] : NULL;
+    }
+    *newRoot = count > 0 ? placed[1] : NULL;
+
+    free(placed);
+    free(array->nodes);
+    free(array);
+    return frozen;
+}
+
+// Branch-free descent along pool links, returns pool index or 0
+int frozenSearch(const FrozenPokedex* frozen, int id) {
+    const CompactNode* pool = frozen->pool;
+    unsigned int count = (unsigned int)frozen->count;
+    unsigned int target = (unsigned int)id;
+    unsigned int k = count ? 1 : 0;
+    unsigned int found = 0;
+
+    while(k) {
+        // Pool is in BFS order, so four levels down starts at 16k
+        if(16 * k <= count) {
+            __builtin_prefetch(pool + 16 * k);
+        }
+        const CompactNode* node = &pool[k];
+        found = node->id == target ? k : found;
+        k = node->child[node->id < target];
+    }
+
+    return (int)found;
+}
+
+// Visit frozen data in BFS order, details from the catalog
+void frozenScanBFS(const FrozenPokedex* frozen, VisitDataFunc visit) {
+    for(int k = 1; k <= frozen->count; k++) {
+        visit(getSpecies((int)frozen->pool[k].id));
+    }
+}
+
+// Drop reference, free on last one
+void releaseFrozen(FrozenPokedex* frozen) {
+    if(!frozen || __atomic_sub_fetch(&frozen->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    free(frozen->pool);
+    free(frozen);
+}
+
+// Pin frozen copy
+FrozenPokedex* acquireFrozen(OwnerNode* owner) {
+    pthread_mutex_lock(&owner->lock);
+    FrozenPokedex* frozen = owner->frozen;
+    if(frozen) {
+        __atomic_add_fetch(&frozen->refs, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&owner->lock);
+
+    return frozen;
+}
+
+// Freeze owner pokedex
+OpStatus ownerFreezePokedex(OwnerNode* owner, int* count) {
+    pthread_mutex_lock(&owner->lock);
+    if(!owner->pokedexRoot) {
+        pthread_mutex_unlock(&owner->lock);
+        return OP_EMPTY;
+    }
+
+    thawPokedex(owner);
+    owner->frozen = freezeTree(owner->pokedexRoot, &owner->pokedexRoot);
+    // Tree shape changed, readers get the new one too
+    publishSnapshot(owner, persistentFromTree(owner->pokedexRoot));
+    *count = owner->frozen->count;
+    pthread_mutex_unlock(&owner->lock);
+
+    return OP_OK;
+}
+
+// Drop frozen copy
+void thawPokedex(OwnerNode* owner) {
+    FrozenPokedex* frozen = owner->frozen;
+    owner->frozen = NULL;
+    releaseFrozen(frozen);
+}
+
+// Freeze menu entry
+void freezePokedexMenu(OwnerNode* owner) {
+    int count;
+    if(ownerFreezePokedex(owner, &count) != OP_OK) {
+        printf("Pokedex is empty.\n");
+        return;
+    }
+    printf("Pokedex frozen for fast reads (%d Pokemon).\n", count);
+}
+
+
+// CATALOG FUNCTIONS
+// Built in table wrapped as a catalog
+static const Catalog builtinCatalog = {pokedex, (int)(sizeof(pokedex) / sizeof(pokedex[0])), NULL, NULL};
+static const Catalog* activeCatalog = &builtinCatalog;
+
+// Open addressing table of interned names
+typedef struct {
+    unsigned int* slots;    // Offset + 1 into the name storage, 0 is empty
+    size_t mask;
+    char* names;
+    size_t used;
+} NameInterner;
+
+// Return the stored copy of a name, adding it if new
+static char* internName(NameInterner* interner, const char* name, size_t len) {
+    // FNV-1a
+    unsigned long hash = 2166136261UL;
+    for(size_t i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)name[i]) * 16777619UL;
+    }
+
+    size_t slot = hash & interner->mask;
+    while(interner->slots[slot]) {
+        char* stored = interner->names + interner->slots[slot] - 1;
+        if(memcmp(stored, name, len) == 0 && stored[len] == '\0') {
+            return stored;
+        }
+        slot = (slot + 1) & interner->mask;
+    }
+
+    char* stored = interner->names + interner->used;
+    memcpy(stored, name, len);
+    stored[len] = '\0';
+    interner->slots[slot] = (unsigned int)interner->used + 1;
+    interner->used += len + 1;
+    return stored;
+}
+
+// Cut the next comma separated field, trimmed
+static const char* nextCatalogField(const char** at, const char* end, size_t* len) {
+    const char* start = *at;
+    while(start < end && (*start == ' ' || *start == '\t')) {
+        start++;
+    }
+    if(start >= end) {
+        *at = end;
+        *len = 0;
+        return end;
+    }
+    const char* stop = memchr(start, ',', (size_t)(end - start));
+    if(!stop) {
+        stop = end;
+    }
+    *at = stop < end ? stop + 1 : end;
+
+    while(stop > start && isspace((unsigned char)stop[-1])) {
+        stop--;
+    }
+    *len = stop - start;
+    return start;
+}
+
+// Parse a whole field as a non-negative int
+static int parseCatalogInt(const char* field, size_t len, int* value) {
+    long parsed = 0;
+    if(len == 0 || len > 9) {
+        return 0;
+    }
+    for(size_t i = 0; i < len; i++) {
+        if(!isdigit((unsigned char)field[i])) {
+            return 0;
+        }
+        parsed = parsed * 10 + (field[i] - '0');
+    }
+    *value = (int)parsed;
+    return 1;
+}
+
+// Type by number or by name, any case
+static int parseCatalogType(const char* field, size_t len, PokemonType* type) {
+    int number;
+    if(parseCatalogInt(field, len, &number)) {
+        if(number >= TYPE_COUNT) {
+            return 0;
+        }
+        *type = (PokemonType)number;
+        return 1;
+    }
+    for(int t = 0; t < TYPE_COUNT; t++) {
+        const char* name = getTypeName((PokemonType)t);
+        if(strlen(name) == len && strncasecmp(name, field, len) == 0) {
+            *type = (PokemonType)t;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Parse one catalog row, name is left for interning
+static int parseCatalogRow(const char* line, const char* end, PokemonData* data, const char** name, size_t* nameLen) {
+    const char* at = line;
+    size_t len;
+    const char* field = nextCatalogField(&at, end, &len);
+    if(!parseCatalogInt(field, len, &data->id)) {
+        return 0;
+    }
+    *name = nextCatalogField(&at, end, nameLen);
+    if(*nameLen == 0) {
+        return 0;
+    }
+    field = nextCatalogField(&at, end, &len);
+    if(!parseCatalogType(field, len, &data->TYPE)) {
+        return 0;
+    }
+    field = nextCatalogField(&at, end, &len);
+    if(!parseCatalogInt(field, len, &data->hp)) {
+        return 0;
+    }
+    field = nextCatalogField(&at, end, &len);
+    if(!parseCatalogInt(field, len, &data->attack)) {
+        return 0;
+    }
+    field = nextCatalogField(&at, end, &len);
+    if(len == 1 && (*field == '0' || *field == '1')) {
+        data->CAN_EVOLVE = *field == '1' ? CAN_EVOLVE : CANNOT_EVOLVE;
+    } else if(len == 10 && strncasecmp(field, "CAN_EVOLVE", len) == 0) {
+        data->CAN_EVOLVE = CAN_EVOLVE;
+    } else if(len == 13 && strncasecmp(field, "CANNOT_EVOLVE", len) == 0) {
+        data->CAN_EVOLVE = CANNOT_EVOLVE;
+    } else {
+        return 0;
+    }
+    // Nothing may follow the last field
+    return at == end;
+}
+
+// Parse every row of a mapped catalog into entries
+static int parseCatalogText(const char* text, size_t size, Catalog* catalog, size_t capacity, NameInterner* interner) {
+    const char* end = text + size;
+    const char* line = text;
+    int lineNumber = 0;
+    int rows = 0;
+
+    while(line < end) {
+        const char* stop = memchr(line, '\n', end - line);
+        if(!stop) {
+            stop = end;
+        }
+        lineNumber++;
+
+        // Skip blanks, comments and a header line
+        const char* first = line;
+        while(first < stop && isspace((unsigned char)*first)) {
+            first++;
+        }
+        if(first < stop && *first != '#' && (lineNumber > 1 || isdigit((unsigned char)*first))) {
+            PokemonData data;
+            const char* name;
+            size_t nameLen;
+            if(!parseCatalogRow(first, stop, &data, &name, &nameLen)) {
+                fprintf(stderr, "Catalog line %d: malformed row.\n", lineNumber);
+                return 0;
+            }
+            if(data.id < 1 || (size_t)data.id > capacity) {
+                fprintf(stderr, "Catalog line %d: ID %d out of range.\n", lineNumber, data.id);
+                return 0;
+            }
+            if(catalog->entries[data.id - 1].name) {
+                fprintf(stderr, "Catalog line %d: duplicate ID %d.\n", lineNumber, data.id);
+                return 0;
+            }
+            data.name = internName(interner, name, nameLen);
+            catalog->entries[data.id - 1] = data;
+            rows++;
+        }
+        line = stop + 1;
+    }
+
+    // IDs must be exactly 1..rows for direct indexing
+    for(int i = 0; i < rows; i++) {
+        if(!catalog->entries[i].name) {
+            fprintf(stderr, "Catalog: ID %d is missing.\n", i + 1);
+            return 0;
+        }
+        // Evolution is always to the next ID
+        if(catalog->entries[i].CAN_EVOLVE == CAN_EVOLVE && i + 1 >= rows) {
+            fprintf(stderr, "Catalog: ID %d can evolve but ID %d is missing.\n", i + 1, i + 2);
+            return 0;
+        }
+    }
+    if(rows == 0) {
+        fprintf(stderr, "Catalog: no species found.\n");
+        return 0;
+    }
+
+    catalog->count = rows;
+    return 1;
+}
+
+// Load catalog file
+int loadCatalog(const char* path, Catalog* catalog) {
+    memset(catalog, 0, sizeof(Catalog));
+
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        fprintf(stderr, "Cannot open catalog %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    struct stat info;
+    // Name offsets are 32 bit
+    if(fstat(fd, &info) < 0 || info.st_size == 0 || (unsigned long long)info.st_size >= UINT_MAX) {
+        fprintf(stderr, "Catalog %s is empty, too big or unreadable.\n", path);
+        close(fd);
+        return 0;
+    }
+    size_t size = (size_t)info.st_size;
+    const char* text = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(text == MAP_FAILED) {
+        fprintf(stderr, "Cannot map catalog %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    posix_madvise((void*)text, size, POSIX_MADV_SEQUENTIAL);
+
+    // Line count bounds the number of rows
+    size_t capacity = 1;
+    for(const char* at = text; (at = memchr(at, '\n', text + size - at)); at++) {
+        capacity++;
+    }
+    size_t tableSize = 16;
+    while(tableSize < 2 * capacity) {
+        tableSize *= 2;
+    }
+
+    // Names never take more room than the file itself
+    catalog->entries = (PokemonData*) calloc(capacity, sizeof(PokemonData));
+    catalog->names = (char*) malloc(size + 1);
+    NameInterner interner = {(unsigned int*) calloc(tableSize, sizeof(unsigned int)), tableSize - 1, catalog->names, 0};
+
+    int ok = parseCatalogText(text, size, catalog, capacity, &interner);
+    free(interner.slots);
+    munmap((void*)text, size);
+
+    if(!ok) {
+        freeCatalog(catalog);
+        return 0;
+    }
+    catalog->species = catalog->entries;
+    return 1;
+}
+
+// Free loaded catalog
+void freeCatalog(Catalog* catalog) {
+    free(catalog->entries);
+    free(catalog->names);
+    memset(catalog, 0, sizeof(Catalog));
+}
+
+// Name index of the active catalog
+static NameIndex activeNames = {0, NULL, NULL, 0, 0};
+
+// Case blind FNV-1a of a name, salted
+static unsigned long long hashSpeciesName(const char* name, unsigned long long salt) {
+    unsigned long long hash = 14695981039346656037ULL ^ salt;
+    for(; *name; name++) {
+        hash = (hash ^ (unsigned char)tolower((unsigned char)*name)) * 1099511628211ULL;
+    }
+    // FNV leaves the high bits weak on short names, mix them in
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// Bucket from the high hash bits, so sorting by hash groups buckets
+static int nameBucket(unsigned long long hash, int buckets) {
+    return (int)(((hash >> 32) * (unsigned long long)buckets) >> 32);
+}
+
+// Slot of a hash under a bucket seed
+static int nameSlot(unsigned long long hash, int seed, int size) {
+    if(seed < 0) {
+        return -seed - 1;
+    }
+    // splitmix64 finalizer
+    unsigned long long x = hash + 0x9E3779B97F4A7C15ULL * (unsigned long long)(seed + 1);
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return (int)(x % (unsigned long long)size);
+}
+
+typedef struct {
+    unsigned long long hash;
+    int id;
+} NameKey;
+
+// Sort keys by hash, then ID so the lowest ID leads duplicates
+static int compareNameKeys(const void* a, const void* b) {
+    const NameKey* x = (const NameKey*) a;
+    const NameKey* y = (const NameKey*) b;
+    if(x->hash != y->hash) {
+        return x->hash < y->hash ? -1 : 1;
+    }
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+// One hash and displace attempt, 0 if this salt does not work out
+static int tryNameIndex(const Catalog* catalog, NameIndex* index, NameKey* keys) {
+    int count = catalog->count;
+    for(int i = 0; i < count; i++) {
+        keys[i].hash = hashSpeciesName(catalog->species[i].name, index->salt);
+        keys[i].id = i + 1;
+    }
+    qsort(keys, count, sizeof(NameKey), compareNameKeys);
+
+    // Drop repeated names, equal hashes of different names need a new salt
+    int size = 0;
+    for(int i = 0; i < count; i++) {
+        if(size > 0 && keys[size - 1].hash == keys[i].hash) {
+            if(strcasecmp(catalog->species[keys[size - 1].id - 1].name, catalog->species[keys[i].id - 1].name) != 0) {
+                return 0;
+            }
+            continue;
+        }
+        keys[size++] = keys[i];
+    }
+
+    index->size = size;
+    index->buckets = size / 2 + 1;
+    index->seeds = (int*) calloc(index->buckets, sizeof(int));
+    index->ids = (int*) malloc(sizeof(int) * size);
+    int* start = (int*) calloc(index->buckets + 1, sizeof(int));
+    int* order = (int*) malloc(sizeof(int) * index->buckets);
+    char* taken = (char*) calloc(size, 1);
+
+    // Keys are sorted by hash, so each bucket is one run
+    for(int i = 0; i < size; i++) {
+        start[nameBucket(keys[i].hash, index->buckets) + 1]++;
+    }
+    int largest = 0;
+    for(int b = 0; b < index->buckets; b++) {
+        largest = start[b + 1] > largest ? start[b + 1] : largest;
+        start[b + 1] += start[b];
+    }
+
+    // Biggest buckets first, counting sort on size
+    int placed = 0;
+    for(int bucketSize = largest; bucketSize >= 1; bucketSize--) {
+        for(int b = 0; b < index->buckets; b++) {
+            if(start[b + 1] - start[b] == bucketSize) {
+                order[placed++] = b;
+            }
+        }
+    }
+
+    int ok = 1;
+    int freeSlot = 0;
+    int slots[64];
+    for(int i = 0; i < placed && ok; i++) {
+        int b = order[i];
+        int first = start[b], bucketSize = start[b + 1] - start[b];
+
+        // Single keys go straight to any free slot
+        if(bucketSize == 1) {
+            while(taken[freeSlot]) {
+                freeSlot++;
+            }
+            taken[freeSlot] = 1;
+            index->seeds[b] = -freeSlot - 1;
+            index->ids[freeSlot] = keys[first].id;
+            continue;
+        }
+
+        // Search a seed that sends the whole bucket to free, distinct slots
+        int seed, found = 0;
+        for(seed = 0; seed < (1 << 20) && bucketSize <= 64 && !found; seed++) {
+            found = 1;
+            for(int k = 0; k < bucketSize && found; k++) {
+                slots[k] = nameSlot(keys[first + k].hash, seed, size);
+                found = !taken[slots[k]];
+                for(int j = 0; j < k && found; j++) {
+                    found = slots[j] != slots[k];
+                }
+            }
+        }
+        if(!found) {
+            ok = 0;
+            break;
+        }
+        index->seeds[b] = seed - 1;
+        for(int k = 0; k < bucketSize; k++) {
+            taken[slots[k]] = 1;
+            index->ids[slots[k]] = keys[first + k].id;
+        }
+    }
+
+    free(start);
+    free(order);
+    free(taken);
+    if(!ok) {
+        free(index->seeds);
+        free(index->ids);
+    }
+    return ok;
+}
+
+// Build name index for a catalog
+void buildNameIndex(const Catalog* catalog, NameIndex* index) {
+    NameKey* keys = (NameKey*) malloc(sizeof(NameKey) * catalog->count);
+    index->salt = 0;
+    while(!tryNameIndex(catalog, index, keys)) {
+        index->salt += 0x9E3779B97F4A7C15ULL;
+    }
+    free(keys);
+}
+
+// Free name index
+void freeNameIndex(NameIndex* index) {
+    free(index->seeds);
+    free(index->ids);
+    memset(index, 0, sizeof(NameIndex));
+}
+
+// Species ID by name, 0 if none
+int findSpeciesByName(const char* name) {
+    if(activeNames.size == 0) {
+        return 0;
+    }
+    unsigned long long hash = hashSpeciesName(name, activeNames.salt);
+    int seed = activeNames.seeds[nameBucket(hash, activeNames.buckets)];
+    int id = activeNames.ids[nameSlot(hash, seed, activeNames.size)];
+
+    return strcasecmp(getSpecies(id)->name, name) == 0 ? id : 0;
+}
+
+// Switch the active catalog and index its names
+void useCatalog(const Catalog* catalog) {
+    activeCatalog = catalog ? catalog : &builtinCatalog;
+    freeNameIndex(&activeNames);
+    buildNameIndex(activeCatalog, &activeNames);
+}
+
+// Back to the built in catalog, no name index
+void closeCatalog(void) {
+    freeNameIndex(&activeNames);
+    activeCatalog = &builtinCatalog;
+}
+
+// Species by ID, NULL if out of range
+const PokemonData* getSpecies(int id) {
+    if(id < 1 || id > activeCatalog->count) {
+        return NULL;
+    }
+    return &activeCatalog->species[id - 1];
+}
+
+// Species count of the active catalog
+int speciesCount(void) {
+    return activeCatalog->count;
+}
+
+
+// BULK RELEASE FUNCTIONS
+// Parse filter text
+int parsePokemonFilter(const char* text, PokemonFilter* filter) {
+    static const char* fields[] = {"id", "type", "hp", "attack", "evolve"};
+    static const char* ops[] = {"<", "<=", "==", "!=", ">=", ">"};
+    char field[16], op[4], value[32], extra[2];
+    if(sscanf(text, "%15s %3s %31s %1s", field, op, value, extra) != 3) {
+        return 0;
+    }
+
+    int found = 0;
+    for(int i = 0; i < 5; i++) {
+        if(strcasecmp(field, fields[i]) == 0) {
+            filter->field = (FilterField)i;
+            found = 1;
+        }
+    }
+    for(int i = 0; i < 6 && found; i++) {
+        if(strcmp(op, ops[i]) == 0) {
+            filter->op = (FilterOp)i;
+            found = 2;
+        }
+    }
+    if(found != 2) {
+        return 0;
+    }
+
+    // Types by name, evolve as yes/no as well
+    PokemonType type;
+    if(filter->field == FILTER_TYPE && parseCatalogType(value, strlen(value), &type)) {
+        filter->value = (int)type;
+        return 1;
+    }
+    if(filter->field == FILTER_EVOLVE && (strcasecmp(value, "yes") == 0 || strcasecmp(value, "no") == 0)) {
+        filter->value = strcasecmp(value, "yes") == 0;
+        return 1;
+    }
+    if(filter->field == FILTER_TYPE) {
+        return 0;
+    }
+    char* end;
+    long parsed = strtol(value, &end, 10);
+    if(*end != '\0' || parsed < INT_MIN || parsed > INT_MAX) {
+        return 0;
+    }
+    filter->value = (int)parsed;
+    return 1;
+}
+
+// Test Pokemon against filter
+int matchPokemonFilter(const PokemonData* data, const void* arg) {
+    const PokemonFilter* filter = (const PokemonFilter*) arg;
+    int value;
+    switch(filter->field) {
+    case FILTER_ID:
+        value = data->id;
+        break;
+    case FILTER_TYPE:
+        value = (int)data->TYPE;
+        break;
+    case FILTER_HP:
+        value = data->hp;
+        break;
+    case FILTER_ATTACK:
+        value = data->attack;
+        break;
+    default:
+        value = data->CAN_EVOLVE == CAN_EVOLVE;
+        break;
+    }
+
+    switch(filter->op) {
+    case FILTER_LT:
+        return value < filter->value;
+    case FILTER_LE:
+        return value <= filter->value;
+    case FILTER_EQ:
+        return value == filter->value;
+    case FILTER_NE:
+        return value != filter->value;
+    case FILTER_GE:
+        return value >= filter->value;
+    default:
+        return value > filter->value;
+    }
+}
+
+// In-order pass freeing matches and keeping the rest in ID order
+static void releaseMatching(PokemonNode* root, PokemonPredicate match, const void* arg, NodeArray* kept,
+                            PokedexTotals* totals, int* released) {
+    if(!root) {
+        return;
+    }
+    releaseMatching(root->left, match, arg, kept, totals, released);
+
+    // Right child is read before the node may be freed
+    PokemonNode* right = root->right;
+    if(match(root->data, arg)) {
+        removeFromTotals(totals, root->data);
+        free(root->data);
+        free(root);
+        (*released)++;
+    } else {
+        addNode(kept, root);
+    }
+    releaseMatching(right, match, arg, kept, totals, released);
+}
+
+// Release matching Pokemon under owner lock
+OpStatus ownerReleaseWhere(OwnerNode* owner, PokemonPredicate match, const void* arg, int* released) {
+    *released = 0;
+    pthread_mutex_lock(&owner->lock);
+    if(!owner->pokedexRoot) {
+        pthread_mutex_unlock(&owner->lock);
+        return OP_EMPTY;
+    }
+
+    thawPokedex(owner);
+    dropCounterIndex(owner);
+    NodeArray* kept = initNodeArray(5);
+    releaseMatching(owner->pokedexRoot, match, arg, kept, &owner->totals, released);
+
+    // Survivors are already sorted, link them up once
+    owner->pokedexRoot = buildBalancedTree(kept->nodes, kept->size);
+    publishSnapshot(owner, persistentFromTree(owner->pokedexRoot));
+    pthread_mutex_unlock(&owner->lock);
+
+    free(kept->nodes);
+    free(kept);
+    return *released > 0 ? OP_OK : OP_NOT_FOUND;
+}
+
+// Release by filter menu entry
+void releaseWhereMenu(OwnerNode* owner) {
+    // Validate pokedex exist
+    if(!owner->pokedexRoot) {
+        printf("No Pokemon to release.\n");
+        return;
+    }
+
+    // Get filter input
+    PokemonFilter filter;
+    printf("Release where (e.g. type == BUG, hp < 50, evolve == no): ");
+    char* input = getDynamicInput();
+    while(!input || !parsePokemonFilter(input, &filter)) {
+        printf("Invalid filter.\n");
+        printf("Release where (e.g. type == BUG, hp < 50, evolve == no): ");
+        input = getDynamicInput();
+    }
+
+    int released;
+    if(ownerReleaseWhere(owner, matchPokemonFilter, &filter, &released) != OP_OK) {
+        printf("No Pokemon matched.\n");
+        return;
+    }
+    printf("Released %d Pokemon.\n", released);
+}
+
+
+// TREE HEALTH FUNCTIONS
+// Sum depths of a version
+static void walkTreeHealth(PersistentNode* root, int depth, TreeHealth* health, long* totalDepth) {
+    if(!root) {
+        return;
+    }
+    health->count++;
+    *totalDepth += depth;
+    if(depth > health->maxDepth) {
+        health->maxDepth = depth;
+    }
+    walkTreeHealth(root->left, depth + 1, health, totalDepth);
+    walkTreeHealth(root->right, depth + 1, health, totalDepth);
+}
+
+// Smallest height a tree of count nodes can have
+static int minimalHeight(int count) {
+    int height = 0;
+    while(count > 0) {
+        count /= 2;
+        height++;
+    }
+    return height;
+}
+
+// Measure version shape
+void computeTreeHealth(PersistentNode* root, TreeHealth* health) {
+    long totalDepth = 0;
+    health->count = 0;
+    health->maxDepth = 0;
+    walkTreeHealth(root, 0, health, &totalDepth);
+
+    health->height = health->count > 0 ? health->maxDepth + 1 : 0;
+    health->avgDepth = health->count > 0 ? (double)totalDepth / health->count : 0.0;
+    health->imbalance = health->count > 0 ? (double)health->height / minimalHeight(health->count) : 1.0;
+}
+
+// Rotate the whole tree into a sorted right vine, return its length
+static int treeToVine(PokemonNode* pseudoRoot) {
+    int count = 0;
+    PokemonNode* tail = pseudoRoot;
+    PokemonNode* rest = tail->right;
+    while(rest) {
+        if(!rest->left) {
+            tail = rest;
+            rest = rest->right;
+            count++;
+        } else {
+            // Rotate right around rest
+            PokemonNode* left = rest->left;
+            rest->left = left->right;
+            left->right = rest;
+            rest = left;
+            tail->right = left;
+        }
+    }
+    return count;
+}
+
+// Left rotate every second vine node, times count
+static void compressVine(PokemonNode* pseudoRoot, int count) {
+    PokemonNode* scanner = pseudoRoot;
+    for(int i = 0; i < count; i++) {
+        PokemonNode* child = scanner->right;
+        scanner->right = child->right;
+        scanner = scanner->right;
+        child->right = scanner->left;
+        scanner->left = child;
+    }
+}
+
+// Day-Stout-Warren rebalance
+PokemonNode* rebalanceTree(PokemonNode* root) {
+    PokemonNode pseudoRoot;
+    pseudoRoot.data = NULL;
+    pseudoRoot.left = NULL;
+    pseudoRoot.right = root;
+    int count = treeToVine(&pseudoRoot);
+
+    // Fill the bottom level first so the rest is a perfect tree
+    int perfect = 1;
+    while(perfect * 2 <= count + 1) {
+        perfect *= 2;
+    }
+    compressVine(&pseudoRoot, count + 1 - perfect);
+    for(int size = perfect - 1; size > 1; ) {
+        size /= 2;
+        compressVine(&pseudoRoot, size);
+    }
+
+    return pseudoRoot.right;
+}
+
+// Rebalance owner pokedex under owner lock
+OpStatus ownerRebalance(OwnerNode* owner) {
+    pthread_mutex_lock(&owner->lock);
+    if(!owner->pokedexRoot) {
+        pthread_mutex_unlock(&owner->lock);
+        return OP_EMPTY;
+    }
+    thawPokedex(owner);
+    owner->pokedexRoot = rebalanceTree(owner->pokedexRoot);
+    publishSnapshot(owner, persistentFromTree(owner->pokedexRoot));
+    pthread_mutex_unlock(&owner->lock);
+
+    return OP_OK;
+}
+
+// Depth of Pokemon by ID
+int depthOfPokemon(PokemonNode* root, int id) {
+    for(int depth = 0; root; depth++) {
+        if(root->data->id == id) {
+            return depth;
+        }
+        root = root->data->id > id ? root->left : root->right;
+    }
+    return -1;
+}
+
+// Rebalance once the threshold is passed
+void maybeRebalance(OwnerNode* owner, int depth) {
+    if(owner->rebalanceDepth <= 0 || depth <= owner->rebalanceDepth) {
+        return;
+    }
+    thawPokedex(owner);
+    owner->pokedexRoot = rebalanceTree(owner->pokedexRoot);
+    publishSnapshot(owner, persistentFromTree(owner->pokedexRoot));
+}
+
+// Tree health menu entry
+void treeHealthMenu(OwnerNode* owner) {
+    // Measure a pinned version
+    TreeHealth health;
+    PersistentNode* snapshot = acquirePokedexSnapshot(owner);
+    FrozenPokedex* frozen = acquireFrozen(owner);
+    computeTreeHealth(snapshot, &health);
+    releasePersistent(snapshot);
+
+    printf("Pokemon: %d\n", health.count);
+    printf("Height: %d (best possible %d)\n", health.height, minimalHeight(health.count));
+    printf("Max depth: %d, average depth: %.2f\n", health.maxDepth, health.avgDepth);
+    printf("Imbalance ratio: %.2f\n", health.imbalance);
+    printf("Memory: %zu bytes of pointer nodes\n", pointerNodeBytes(health.count));
+    if(frozen) {
+        printf("Frozen pool: %zu bytes, %zu per Pokemon\n", frozenPoolBytes(frozen), sizeof(CompactNode));
+    }
+    releaseFrozen(frozen);
+    if(owner->rebalanceDepth > 0) {
+        printf("Auto-rebalance past depth: %d\n", owner->rebalanceDepth);
+    } else {
+        printf("Auto-rebalance: off\n");
+    }
+
+    printf("1. Rebalance now\n");
+    printf("2. Set auto-rebalance depth\n");
+    printf("3. Back\n");
+    int choice = readIntSafe("Your choice: ");
+    if(choice == 1) {
+        if(ownerRebalance(owner) == OP_OK) {
+            printf("Pokedex rebalanced.\n");
+        } else {
+            printf("Pokedex is empty.\n");
+        }
+    } else if(choice == 2) {
+        int depth = readIntSafe("Rebalance when depth passes (0 = off): ");
+        pthread_mutex_lock(&owner->lock);
+        owner->rebalanceDepth = depth > 0 ? depth : 0;
+        pthread_mutex_unlock(&owner->lock);
+    }
+}
+
+
+// ALLOCATION PROFILER FUNCTIONS
+#ifdef EX6_ALLOC_PROFILE
+
+#define PROFILE_MAGIC 0xA110CA7EU
+
+// Bookkeeping in front of every profiled block
+typedef union AllocHeader {
+    struct {
+        union AllocHeader* prev;
+        union AllocHeader* next;
+        size_t size;
+        const char* file;
+        int line;
+        int op;
+        unsigned int magic;
+    } info;
+    long double align;          // Keeps the user block aligned like malloc's
+} AllocHeader;
+
+typedef struct {
+    char name[PROFILE_OP_NAME];
+    unsigned long calls;
+    unsigned long frees;
+    size_t bytes;
+} OpProfile;
+
+// The macros are off here, (malloc) and friends are the real ones
+static pthread_mutex_t profileLock = PTHREAD_MUTEX_INITIALIZER;
+static AllocHeader liveBlocks = {{&liveBlocks, &liveBlocks, 0, NULL, 0, 0, 0}};
+static OpProfile profileOps[PROFILE_MAX_OPS] = {{"startup", 0, 0, 0}};
+static int profileOpCount = 1;
+static __thread int currentProfileOp = 0;
+static size_t liveBytes = 0;
+static size_t peakBytes = 0;
+
+// Link block and charge it, profile lock held
+static void trackBlock(AllocHeader* header, size_t size, const char* file, int line) {
+    header->info.size = size;
+    header->info.file = file;
+    header->info.line = line;
+    header->info.op = currentProfileOp;
+    header->info.magic = PROFILE_MAGIC;
+    header->info.next = liveBlocks.info.next;
+    header->info.prev = &liveBlocks;
+    liveBlocks.info.next->info.prev = header;
+    liveBlocks.info.next = header;
+
+    profileOps[currentProfileOp].calls++;
+    profileOps[currentProfileOp].bytes += size;
+    liveBytes += size;
+    if(liveBytes > peakBytes) {
+        peakBytes = liveBytes;
+    }
+}
+
+// Unlink block, profile lock held
+static void untrackBlock(AllocHeader* header) {
+    if(header->info.magic != PROFILE_MAGIC) {
+        fprintf(stderr, "profFree: block not from the profiler\n");
+        abort();
+    }
+    header->info.prev->info.next = header->info.next;
+    header->info.next->info.prev = header->info.prev;
+    header->info.magic = 0;
+    liveBytes -= header->info.size;
+    profileOps[currentProfileOp].frees++;
+}
+
+// Profiled malloc
+void* profMalloc(size_t size, const char* file, int line) {
+    AllocHeader* header = (AllocHeader*) (malloc)(sizeof(AllocHeader) + size);
+    if(!header) {
+        return NULL;
+    }
+    pthread_mutex_lock(&profileLock);
+    trackBlock(header, size, file, line);
+    pthread_mutex_unlock(&profileLock);
+    return header + 1;
+}
+
+// Profiled calloc
+void* profCalloc(size_t count, size_t size, const char* file, int line) {
+    if(size && count > ((size_t)-1 - sizeof(AllocHeader)) / size) {
+        return NULL;
+    }
+    void* block = profMalloc(count * size, file, line);
+    if(block) {
+        memset(block, 0, count * size);
+    }
+    return block;
+}
+
+// Profiled realloc
+void* profRealloc(void* ptr, size_t size, const char* file, int line) {
+    if(!ptr) {
+        return profMalloc(size, file, line);
+    }
+    AllocHeader* header = (AllocHeader*) ptr - 1;
+    pthread_mutex_lock(&profileLock);
+    untrackBlock(header);
+    AllocHeader* moved = (AllocHeader*) (realloc)(header, sizeof(AllocHeader) + size);
+    // On failure the old block stays valid and tracked
+    if(!moved) {
+        trackBlock(header, header->info.size, header->info.file, header->info.line);
+        pthread_mutex_unlock(&profileLock);
+        return NULL;
+    }
+    trackBlock(moved, size, file, line);
+    pthread_mutex_unlock(&profileLock);
+    return moved + 1;
+}
+
+// Profiled free
+void profFree(void* ptr) {
+    if(!ptr) {
+        return;
+    }
+    AllocHeader* header = (AllocHeader*) ptr - 1;
+    pthread_mutex_lock(&profileLock);
+    untrackBlock(header);
+    pthread_mutex_unlock(&profileLock);
+    (free)(header);
+}
+
+// Switch the current operation of this thread
+void profileOperation(const char* name) {
+    pthread_mutex_lock(&profileLock);
+    int found = 0;
+    for(int i = 0; i < profileOpCount && !found; i++) {
+        if(strncmp(profileOps[i].name, name, PROFILE_OP_NAME - 1) == 0) {
+            currentProfileOp = i;
+            found = 1;
+        }
+    }
+    // Table full, charge the rest to the first entry
+    if(!found) {
+        currentProfileOp = profileOpCount < PROFILE_MAX_OPS ? profileOpCount++ : 0;
+        if(currentProfileOp > 0) {
+            strncpy(profileOps[currentProfileOp].name, name, PROFILE_OP_NAME - 1);
+        }
+    }
+    pthread_mutex_unlock(&profileLock);
+}
+
+// Order live blocks by site
+static int compareAllocSites(const void* a, const void* b) {
+    const AllocHeader* x = *(AllocHeader* const*) a;
+    const AllocHeader* y = *(AllocHeader* const*) b;
+    int byFile = strcmp(x->info.file, y->info.file);
+    if(byFile != 0) {
+        return byFile;
+    }
+    return (x->info.line > y->info.line) - (x->info.line < y->info.line);
+}
+
+// Print profile and leak report
+void printAllocReport(FILE* out) {
+    pthread_mutex_lock(&profileLock);
+    fprintf(out, "\n=== Allocation Profile ===\n");
+    fprintf(out, "Peak live: %zu bytes\n", peakBytes);
+    fprintf(out, "%-16s %10s %14s %10s\n", "Operation", "Allocs", "Bytes", "Frees");
+    for(int i = 0; i < profileOpCount; i++) {
+        fprintf(out, "%-16s %10lu %14zu %10lu\n", profileOps[i].name, profileOps[i].calls,
+                profileOps[i].bytes, profileOps[i].frees);
+    }
+
+    // Gather live blocks, then group them by site
+    size_t count = 0;
+    for(AllocHeader* at = liveBlocks.info.next; at != &liveBlocks; at = at->info.next) {
+        count++;
+    }
+    fprintf(out, "Leaked: %zu blocks, %zu bytes\n", count, liveBytes);
+    AllocHeader** blocks = (AllocHeader**) (malloc)(sizeof(AllocHeader*) * (count ? count : 1));
+    size_t n = 0;
+    for(AllocHeader* at = liveBlocks.info.next; at != &liveBlocks; at = at->info.next) {
+        blocks[n++] = at;
+    }
+    qsort(blocks, count, sizeof(AllocHeader*), compareAllocSites);
+    for(size_t i = 0; i < count; ) {
+        size_t j = i, bytes = 0;
+        while(j < count && compareAllocSites(&blocks[i], &blocks[j]) == 0) {
+            bytes += blocks[j++]->info.size;
+        }
+        fprintf(out, "  %s:%d  %zu blocks, %zu bytes (first during %s)\n", blocks[i]->info.file,
+                blocks[i]->info.line, j - i, bytes, profileOps[blocks[i]->info.op].name);
+        i = j;
+    }
+    (free)(blocks);
+    pthread_mutex_unlock(&profileLock);
+}
+
+#endif
+
+
+// QUERY PIPELINE FUNCTIONS
+// One row flowing through the stages
+typedef struct {
+    const PokemonData* data;
+    const char* owner;
+    long seq;                   // Arrival order, keeps sorts stable
+} QueryRow;
+
+// A stage takes rows one at a time, push returns 0 once no more are needed
+typedef struct QueryStage {
+    int (*push)(struct QueryStage* stage, const QueryRow* row);
+    void (*finish)(struct QueryStage* stage);
+    struct QueryStage* next;
+    const PokemonQuery* query;
+    QueryRow* rows;             // Sort stage heap
+    int size;
+    int capacity;
+    int count;                  // Rows passed on so far
+    WriteChunkFunc write;       // Project stage sink
+    void* ctx;
+    char* buffer;
+    size_t length;
+} QueryStage;
+
+// Next token, double quotes keep spaces together
+static char* nextQueryToken(char** at) {
+    char* start = *at;
+    while(*start && isspace((unsigned char)*start)) {
+        start++;
+    }
+    if(!*start) {
+        *at = start;
+        return NULL;
+    }
+
+    char* end;
+    if(*start == '"') {
+        start++;
+        end = strchr(start, '"');
+        if(!end) {
+            end = start + strlen(start);
+        }
+    } else {
+        end = start;
+        while(*end && !isspace((unsigned char)*end)) {
+            end++;
+        }
+    }
+    *at = *end ? end + 1 : end;
+    *end = '\0';
+    return start;
+}
+
+// Match a sort or show field name
+static int parseQueryField(const char* token, QueryField* field) {
+    static const char* names[] = {"owner", "id", "name", "type", "hp", "attack", "evolve"};
+    for(int i = 0; i < QUERY_MAX_FIELDS; i++) {
+        if(strcasecmp(token, names[i]) == 0) {
+            *field = (QueryField)i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Parse query text
+int parsePokemonQuery(char* text, PokemonQuery* query) {
+    memset(query, 0, sizeof(*query));
+    query->limit = -1;
+    char* at = text;
+    char* token = nextQueryToken(&at);
+    if(!token || strcasecmp(token, "from") != 0 || !(token = nextQueryToken(&at))) {
+        return 0;
+    }
+    query->source = strcmp(token, "*") == 0 ? NULL : token;
+    token = nextQueryToken(&at);
+
+    // Conditions reuse the filter parser one at a time
+    if(token && strcasecmp(token, "where") == 0) {
+        do {
+            char* field = nextQueryToken(&at);
+            char* op = nextQueryToken(&at);
+            char* value = nextQueryToken(&at);
+            char condition[64];
+            if(!value || query->filterCount == QUERY_MAX_FILTERS
+               || snprintf(condition, sizeof(condition), "%s %s %s", field, op, value) >= (int)sizeof(condition)
+               || !parsePokemonFilter(condition, &query->filters[query->filterCount++])) {
+                return 0;
+            }
+            token = nextQueryToken(&at);
+        } while(token && strcasecmp(token, "and") == 0);
+    }
+
+    if(token && strcasecmp(token, "sort") == 0) {
+        token = nextQueryToken(&at);
+        if(!token || !parseQueryField(token, &query->sortField)) {
+            return 0;
+        }
+        query->sorted = 1;
+        token = nextQueryToken(&at);
+        if(token && (strcasecmp(token, "asc") == 0 || strcasecmp(token, "desc") == 0)) {
+            query->descending = strcasecmp(token, "desc") == 0;
+            token = nextQueryToken(&at);
+        }
+    }
+
+    if(token && strcasecmp(token, "limit") == 0) {
+        token = nextQueryToken(&at);
+        char* end;
+        long limit = token ? strtol(token, &end, 10) : -1;
+        if(!token || end == token || *end != '\0' || limit < 0 || limit > INT_MAX) {
+            return 0;
+        }
+        query->limit = (int)limit;
+        token = nextQueryToken(&at);
+    }
+
+    // Show fields may be split by commas, spaces or both
+    if(token && strcasecmp(token, "show") == 0) {
+        while((token = nextQueryToken(&at))) {
+            char* save = NULL;
+            for(char* field = strtok_r(token, ",", &save); field; field = strtok_r(NULL, ",", &save)) {
+                if(query->fieldCount == QUERY_MAX_FIELDS || !parseQueryField(field, &query->fields[query->fieldCount++])) {
+                    return 0;
+                }
+            }
+        }
+        if(query->fieldCount == 0) {
+            return 0;
+        }
+    }
+    return token == NULL;
+}
+
+// Compare two rows on one field
+static int compareQueryField(QueryField field, const QueryRow* a, const QueryRow* b) {
+    switch(field) {
+    case QUERY_OWNER:
+        return strcmp(a->owner, b->owner);
+    case QUERY_NAME:
+        return strcmp(a->data->name, b->data->name);
+    case QUERY_TYPE:
+        return (int)a->data->TYPE - (int)b->data->TYPE;
+    case QUERY_HP:
+        return (a->data->hp > b->data->hp) - (a->data->hp < b->data->hp);
+    case QUERY_ATTACK:
+        return (a->data->attack > b->data->attack) - (a->data->attack < b->data->attack);
+    case QUERY_EVOLVE:
+        return (int)a->data->CAN_EVOLVE - (int)b->data->CAN_EVOLVE;
+    default:
+        return (a->data->id > b->data->id) - (a->data->id < b->data->id);
+    }
+}
+
+// Output order: sort key, then arrival
+static int rowBefore(const PokemonQuery* query, const QueryRow* a, const QueryRow* b) {
+    int order = compareQueryField(query->sortField, a, b);
+    if(order != 0) {
+        return query->descending ? order > 0 : order < 0;
+    }
+    return a->seq < b->seq;
+}
+
+// Max-heap by output order, the row printed last sits on top
+static void siftRowUp(QueryStage* stage, int i) {
+    while(i > 0) {
+        int parent = (i - 1) / 2;
+        if(!rowBefore(stage->query, &stage->rows[parent], &stage->rows[i])) {
+            return;
+        }
+        QueryRow temp = stage->rows[i];
+        stage->rows[i] = stage->rows[parent];
+        stage->rows[parent] = temp;
+        i = parent;
+    }
+}
+
+static void siftRowDown(QueryStage* stage, int size, int i) {
+    while(1) {
+        int last = i, left = 2 * i + 1, right = 2 * i + 2;
+        if(left < size && rowBefore(stage->query, &stage->rows[last], &stage->rows[left])) {
+            last = left;
+        }
+        if(right < size && rowBefore(stage->query, &stage->rows[last], &stage->rows[right])) {
+            last = right;
+        }
+        if(last == i) {
+            return;
+        }
+        QueryRow temp = stage->rows[i];
+        stage->rows[i] = stage->rows[last];
+        stage->rows[last] = temp;
+        i = last;
+    }
+}
+
+// Drop rows failing any condition
+static int filterStagePush(QueryStage* stage, const QueryRow* row) {
+    for(int i = 0; i < stage->query->filterCount; i++) {
+        if(!matchPokemonFilter(row->data, &stage->query->filters[i])) {
+            return 1;
+        }
+    }
+    return stage->next->push(stage->next, row);
+}
+
+// Pass rows until the limit is reached
+static int limitStagePush(QueryStage* stage, const QueryRow* row) {
+    if(stage->count >= stage->query->limit) {
+        return 0;
+    }
+    stage->count++;
+    return stage->next->push(stage->next, row) && stage->count < stage->query->limit;
+}
+
+// Finish by finishing the next stage
+static void passStageFinish(QueryStage* stage) {
+    stage->next->finish(stage->next);
+}
+
+// Keep all rows, or only the best limit rows
+static int sortStagePush(QueryStage* stage, const QueryRow* row) {
+    if(stage->query->limit < 0 || stage->size < stage->query->limit) {
+        if(stage->size == stage->capacity) {
+            stage->capacity = stage->capacity ? stage->capacity * 2 : 16;
+            stage->rows = (QueryRow*) realloc(stage->rows, sizeof(QueryRow) * stage->capacity);
+        }
+        stage->rows[stage->size] = *row;
+        siftRowUp(stage, stage->size++);
+    } else if(stage->size > 0 && rowBefore(stage->query, row, &stage->rows[0])) {
+        // Beats the worst kept row, which drops out
+        stage->rows[0] = *row;
+        siftRowDown(stage, stage->size, 0);
+    }
+    return 1;
+}
+
+// Heapsort the kept rows and pass them on in order
+static void sortStageFinish(QueryStage* stage) {
+    for(int end = stage->size - 1; end > 0; end--) {
+        QueryRow temp = stage->rows[0];
+        stage->rows[0] = stage->rows[end];
+        stage->rows[end] = temp;
+        siftRowDown(stage, end, 0);
+    }
+    for(int i = 0; i < stage->size && stage->next->push(stage->next, &stage->rows[i]); i++) {
+    }
+    stage->next->finish(stage->next);
+}
+
+// Append text to the output chunk, flushing when it is full
+static void queryAppend(QueryStage* stage, const char* text, size_t len) {
+    if(stage->length + len > QUERY_CHUNK) {
+        stage->write(stage->ctx, stage->buffer, stage->length);
+        stage->length = 0;
+    }
+    if(len > QUERY_CHUNK) {
+        stage->write(stage->ctx, text, len);
+        return;
+    }
+    memcpy(stage->buffer + stage->length, text, len);
+    stage->length += len;
+}
+
+// Format the shown fields of a row
+static int projectStagePush(QueryStage* stage, const QueryRow* row) {
+    static const QueryField full[] = {QUERY_OWNER, QUERY_ID, QUERY_NAME, QUERY_TYPE, QUERY_HP, QUERY_ATTACK, QUERY_EVOLVE};
+    static const char* labels[] = {"Owner", "ID", "Name", "Type", "HP", "Attack", "Can Evolve"};
+    const PokemonQuery* query = stage->query;
+
+    // Default is the usual entry, led by the owner when reading all owners
+    const QueryField* fields = query->fieldCount ? query->fields : full + (query->source != NULL);
+    int count = query->fieldCount ? query->fieldCount : QUERY_MAX_FIELDS - (query->source != NULL);
+    char number[16];
+    for(int i = 0; i < count; i++) {
+        const char* value = number;
+        switch(fields[i]) {
+        case QUERY_OWNER:
+            value = row->owner;
+            break;
+        case QUERY_NAME:
+            value = row->data->name;
+            break;
+        case QUERY_TYPE:
+            value = getTypeName(row->data->TYPE);
+            break;
+        case QUERY_EVOLVE:
+            value = row->data->CAN_EVOLVE == CAN_EVOLVE ? "Yes" : "No";
+            break;
+        case QUERY_ID:
+            snprintf(number, sizeof(number), "%d", row->data->id);
+            break;
+        case QUERY_HP:
+            snprintf(number, sizeof(number), "%d", row->data->hp);
+            break;
+        default:
+            snprintf(number, sizeof(number), "%d", row->data->attack);
+            break;
+        }
+        if(i > 0) {
+            queryAppend(stage, ", ", 2);
+        }
+        queryAppend(stage, labels[fields[i]], strlen(labels[fields[i]]));
+        queryAppend(stage, ": ", 2);
+        queryAppend(stage, value, strlen(value));
+    }
+    queryAppend(stage, "\n", 1);
+    stage->count++;
+    return 1;
+}
+
+// Flush what is left of the output chunk
+static void projectStageFinish(QueryStage* stage) {
+    if(stage->length > 0) {
+        stage->write(stage->ctx, stage->buffer, stage->length);
+        stage->length = 0;
+    }
+}
+
+// Stream one version in ID order, 0 once the chain wants no more rows
+static int pushQuerySource(PersistentNode* root, const char* owner, QueryStage* first, long* seq,
+                           PersistentNode*** stack, int* capacity) {
+    int size = 0;
+    PersistentNode* node = root;
+    while(node || size > 0) {
+        for(; node; node = node->left) {
+            if(size == *capacity) {
+                *capacity = *capacity ? *capacity * 2 : 32;
+                *stack = (PersistentNode**) realloc(*stack, sizeof(PersistentNode*) * *capacity);
+            }
+            (*stack)[size++] = node;
+        }
+        node = (*stack)[--size];
+        QueryRow row = {&node->data, owner, (*seq)++};
+        if(!first->push(first, &row)) {
+            return 0;
+        }
+        node = node->right;
+    }
+    return 1;
+}
 
-    OwnerNode* owner = firstOwner;
-    OwnerNode* newMinOwner = NULL;
-    // If more owners exist add the to new list
-    while(ownerHead) {
-        // Find second min name owner
-        newMinOwner = findMinOwnerName();
-        removeOwnerFromCircularList(newMinOwner);
-        owner->next = newMinOwner;
-        newMinOwner->prev = owner;
-        owner = newMinOwner;
+// Run a query over pinned snapshots
+OpStatus runPokemonQuery(Registry* reg, const PokemonQuery* query, WriteChunkFunc write, void* ctx, int* rows) {
+    *rows = 0;
+    // Owner names stay valid while the ring is read locked
+    pthread_rwlock_rdlock(&reg->lock);
+    int total = 0;
+    OwnerNode* owner = reg->head;
+    if(owner) {
+        do {
+            total++;
+            owner = owner->next;
+        } while(owner != reg->head);
     }
-    // If another owner found add to new list
-    if(newMinOwner) {
-        newMinOwner->next = firstOwner;
-        firstOwner->prev = newMinOwner;
+
+    OwnerNode** sources = (OwnerNode**) malloc(sizeof(OwnerNode*) * (total + 1));
+    int count = 0;
+    if(query->source) {
+        sources[0] = findOwnerByName(reg, query->source);
+        count = sources[0] != NULL;
+        if(!count) {
+            pthread_rwlock_unlock(&reg->lock);
+            free(sources);
+            return OP_NOT_FOUND;
+        }
+    } else {
+        for(owner = reg->head; count < total; owner = owner->next) {
+            sources[count++] = owner;
+        }
+    }
+    PersistentNode** versions = (PersistentNode**) malloc(sizeof(PersistentNode*) * (count + 1));
+    for(int i = 0; i < count; i++) {
+        versions[i] = acquirePokedexSnapshot(sources[i]);
     }
-    // When old list empty make new list head
-    ownerHead = firstOwner;
 
-    printf("Owners sorted by name.\n");
+    // Chain: [filter] -> [sort | limit] -> project
+    char chunk[QUERY_CHUNK];
+    QueryStage stages[3];
+    memset(stages, 0, sizeof(stages));
+    for(int i = 0; i < 3; i++) {
+        stages[i].query = query;
+    }
+    QueryStage* first = &stages[2];
+    first->push = projectStagePush;
+    first->finish = projectStageFinish;
+    first->write = write;
+    first->ctx = ctx;
+    first->buffer = chunk;
+    if(query->sorted || query->limit >= 0) {
+        stages[1].push = query->sorted ? sortStagePush : limitStagePush;
+        stages[1].finish = query->sorted ? sortStageFinish : passStageFinish;
+        stages[1].next = first;
+        first = &stages[1];
+    }
+    if(query->filterCount > 0) {
+        stages[0].push = filterStagePush;
+        stages[0].finish = passStageFinish;
+        stages[0].next = first;
+        first = &stages[0];
+    }
+
+    long seq = 0;
+    PersistentNode** stack = NULL;
+    int capacity = 0;
+    for(int i = 0; i < count && query->limit != 0; i++) {
+        if(!pushQuerySource(versions[i], sources[i]->ownerName, first, &seq, &stack, &capacity)) {
+            break;
+        }
+    }
+    first->finish(first);
+    pthread_rwlock_unlock(&reg->lock);
+    *rows = stages[2].count;
+
+    for(int i = 0; i < count; i++) {
+        releasePersistent(versions[i]);
+    }
+    free(stack);
+    free(stages[1].rows);
+    free(versions);
+    free(sources);
+    return OP_OK;
 }
 
+// Query menu entry
+void queryMenu(Registry* reg) {
+    // Get query input
+    PokemonQuery query;
+    printf("Query (e.g. from * where type == FIRE sort attack desc limit 10 show owner,name,attack): ");
+    char* input = getDynamicInput();
+    while(!input || !parsePokemonQuery(input, &query)) {
+        printf("Invalid query.\n");
+        printf("Query (e.g. from * where type == FIRE sort attack desc limit 10 show owner,name,attack): ");
+        input = getDynamicInput();
+    }
 
-// DATA STRUCTURES MANIPULATING FUNCTIONS
-// Insert new Pokemon node to pokedex tree
-PokemonNode* insertPokemonNode(PokemonNode* root, PokemonNode* newNode) {  
-    int id = newNode->data->id;
+    int rows;
+    if(runPokemonQuery(reg, &query, writeToFile, stdout, &rows) != OP_OK) {
+        printf("Owner not found.\n");
+        return;
+    }
+    if(rows == 0) {
+        printf("No Pokemon matched.\n");
+    }
+}
 
-    if(root->data->id > id) {
-        if(!root->left) {
-            root->left = newNode;
-            return newNode;
+
+// COLUMNAR EXPORT FUNCTIONS
+static const char columnsMagic[8] = "EX6COLS";
+
+// Copy a version into the columns in ID order
+static void fillColumns(PersistentNode* root, PokedexColumns* columns, unsigned int owner, int* row) {
+    if(!root) {
+        return;
+    }
+    fillColumns(root->left, columns, owner, row);
+    columns->owner[*row] = owner;
+    columns->id[*row] = root->data.id;
+    columns->type[*row] = (unsigned char)root->data.TYPE;
+    columns->hp[*row] = root->data.hp;
+    columns->attack[*row] = root->data.attack;
+    (*row)++;
+    fillColumns(root->right, columns, owner, row);
+}
+
+// Allocate the five columns, one spare row so none is empty
+static int allocColumns(PokedexColumns* columns) {
+    size_t rows = (size_t)columns->rows + 1;
+    columns->owner = (unsigned int*) malloc(sizeof(unsigned int) * rows);
+    columns->id = (int*) malloc(sizeof(int) * rows);
+    columns->type = (unsigned char*) malloc(rows);
+    columns->hp = (int*) malloc(sizeof(int) * rows);
+    columns->attack = (int*) malloc(sizeof(int) * rows);
+    return columns->owner && columns->id && columns->type && columns->hp && columns->attack;
+}
+
+// Build columns from the registry
+void buildPokedexColumns(Registry* reg, PokedexColumns* columns) {
+    memset(columns, 0, sizeof(PokedexColumns));
+    pthread_rwlock_rdlock(&reg->lock);
+    int count;
+    OwnerNode** owners = collectOwners(reg, &count);
+    PersistentNode** versions = (PersistentNode**) malloc(sizeof(PersistentNode*) * (count + 1));
+
+    // Names are copied now, so the walk below needs no lock
+    size_t nameBytes = 0;
+    for(int i = 0; i < count; i++) {
+        versions[i] = acquirePokedexSnapshot(owners[i]);
+        nameBytes += strlen(owners[i]->ownerName) + 1;
+    }
+    columns->owners = count;
+    columns->ownerNames = (char**) malloc(sizeof(char*) * (count + 1));
+    columns->nameData = (char*) malloc(nameBytes + 1);
+    char* name = columns->nameData;
+    for(int i = 0; i < count; i++) {
+        columns->ownerNames[i] = strcpy(name, owners[i]->ownerName);
+        name += strlen(name) + 1;
+    }
+    pthread_rwlock_unlock(&reg->lock);
+    free(owners);
+
+    for(int i = 0; i < count; i++) {
+        columns->rows += countPersistent(versions[i]);
+    }
+    allocColumns(columns);
+    int row = 0;
+    for(int i = 0; i < count; i++) {
+        fillColumns(versions[i], columns, (unsigned int)i, &row);
+        releasePersistent(versions[i]);
+    }
+    free(versions);
+}
+
+// Write columns to file
+int exportPokedexColumns(const PokedexColumns* columns, const char* path) {
+    FILE* file = fopen(path, "wb");
+    if(!file) {
+        fprintf(stderr, "Cannot create %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+
+    unsigned int header[3] = {COLUMNS_VERSION, (unsigned int)columns->owners, (unsigned int)columns->rows};
+    int ok = fwrite(columnsMagic, 1, sizeof(columnsMagic), file) == sizeof(columnsMagic)
+             && fwrite(header, sizeof(unsigned int), 3, file) == 3;
+    for(int i = 0; i < columns->owners && ok; i++) {
+        unsigned int length = (unsigned int)strlen(columns->ownerNames[i]);
+        ok = fwrite(&length, sizeof(length), 1, file) == 1
+             && fwrite(columns->ownerNames[i], 1, length, file) == length;
+    }
+
+    // Each column goes out in one write
+    size_t rows = (size_t)columns->rows;
+    ok = ok && fwrite(columns->owner, sizeof(unsigned int), rows, file) == rows
+         && fwrite(columns->id, sizeof(int), rows, file) == rows
+         && fwrite(columns->type, 1, rows, file) == rows
+         && fwrite(columns->hp, sizeof(int), rows, file) == rows
+         && fwrite(columns->attack, sizeof(int), rows, file) == rows;
+    if(fclose(file) != 0) {
+        ok = 0;
+    }
+    if(!ok) {
+        fprintf(stderr, "Cannot write %s: %s\n", path, strerror(errno));
+    }
+    return ok;
+}
+
+// Read and check the owner names of a column file
+static int readColumnNames(FILE* file, PokedexColumns* columns, size_t fileSize) {
+    size_t used = 0, capacity = 64;
+    size_t owners = (size_t)columns->owners;
+    size_t* offsets = (size_t*) malloc(sizeof(size_t) * (owners + 1));
+    columns->nameData = (char*) malloc(capacity);
+    if(!offsets || !columns->nameData) {
+        free(offsets);
+        return 0;
+    }
+    for(size_t i = 0; i < owners; i++) {
+        unsigned int length;
+        if(fread(&length, sizeof(length), 1, file) != 1 || length > fileSize) {
+            free(offsets);
+            return 0;
+        }
+        if(used + length + 1 > capacity) {
+            while(used + length + 1 > capacity) {
+                capacity *= 2;
+            }
+            // Keep the old block on failure so the caller still frees it
+            char* grown = (char*) realloc(columns->nameData, capacity);
+            if(!grown) {
+                free(offsets);
+                return 0;
+            }
+            columns->nameData = grown;
+        }
+        if(fread(columns->nameData + used, 1, length, file) != length) {
+            free(offsets);
+            return 0;
+        }
+        offsets[i] = used;
+        used += length;
+        columns->nameData[used++] = '\0';
+    }
+
+    // Pointers are set once the data stopped moving
+    columns->ownerNames = (char**) malloc(sizeof(char*) * (owners + 1));
+    if(!columns->ownerNames) {
+        free(offsets);
+        return 0;
+    }
+    for(size_t i = 0; i < owners; i++) {
+        columns->ownerNames[i] = columns->nameData + offsets[i];
+    }
+    free(offsets);
+    return 1;
+}
+
+// Load columns from file
+int loadPokedexColumns(const char* path, PokedexColumns* columns) {
+    memset(columns, 0, sizeof(PokedexColumns));
+    FILE* file = fopen(path, "rb");
+    if(!file) {
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    struct stat info;
+    char magic[sizeof(columnsMagic)];
+    unsigned int header[3];
+
+    // Each owner takes at least 4 bytes and each row 17, so both counts must
+    // fit in the file and a bad header cannot allocate much
+    int ok = fstat(fileno(file), &info) == 0
+             && fread(magic, 1, sizeof(magic), file) == sizeof(magic)
+             && memcmp(magic, columnsMagic, sizeof(magic)) == 0
+             && fread(header, sizeof(unsigned int), 3, file) == 3
+             && header[0] == COLUMNS_VERSION && header[1] <= INT_MAX && header[2] <= INT_MAX
+             && (unsigned long long)header[1] * 4 + (unsigned long long)header[2] * 17
+                    <= (unsigned long long)info.st_size;
+    if(ok) {
+        columns->owners = (int)header[1];
+        columns->rows = (int)header[2];
+        ok = readColumnNames(file, columns, (size_t)info.st_size);
+    }
+    if(ok) {
+        size_t rows = (size_t)columns->rows;
+        ok = allocColumns(columns)
+             && fread(columns->owner, sizeof(unsigned int), rows, file) == rows
+             && fread(columns->id, sizeof(int), rows, file) == rows
+             && fread(columns->type, 1, rows, file) == rows
+             && fread(columns->hp, sizeof(int), rows, file) == rows
+             && fread(columns->attack, sizeof(int), rows, file) == rows;
+    }
+    fclose(file);
+
+    // Every value must be one the aggregates can index
+    for(int i = 0; ok && i < columns->rows; i++) {
+        ok = columns->owner[i] < (unsigned int)columns->owners && columns->type[i] < TYPE_COUNT
+             && columns->hp[i] >= 0 && columns->attack[i] >= 0;
+    }
+    if(!ok) {
+        fprintf(stderr, "%s is not a valid column export.\n", path);
+        freePokedexColumns(columns);
+    }
+    return ok;
+}
+
+// Free columns
+void freePokedexColumns(PokedexColumns* columns) {
+    free(columns->ownerNames);
+    free(columns->nameData);
+    free(columns->owner);
+    free(columns->id);
+    free(columns->type);
+    free(columns->hp);
+    free(columns->attack);
+    memset(columns, 0, sizeof(PokedexColumns));
+}
+
+// Aggregate columns by type
+void aggregatePokedexColumns(const PokedexColumns* columns, ColumnAggregates* result) {
+    memset(result, 0, sizeof(ColumnAggregates));
+    const unsigned char* restrict type = columns->type;
+    const int* restrict hp = columns->hp;
+    const int* restrict attack = columns->attack;
+    int rows = columns->rows;
+
+    // One pass, each row lands in its own type's slot and its own buckets
+    for(int i = 0; i < rows; i++) {
+        TypeAggregate* group = &result->types[type[i]];
+        int hpValue = hp[i];
+        int attackValue = attack[i];
+        group->count++;
+        group->hpSum += hpValue;
+        group->attackSum += attackValue;
+        group->hpMax = hpValue > group->hpMax ? hpValue : group->hpMax;
+        group->attackMax = attackValue > group->attackMax ? attackValue : group->attackMax;
+
+        // Values are never negative, so the bucket is the quotient capped at the last
+        int hpBin = hpValue / COLUMN_BIN_WIDTH;
+        int attackBin = attackValue / COLUMN_BIN_WIDTH;
+        result->hpHistogram[hpBin < COLUMN_BINS - 1 ? hpBin : COLUMN_BINS - 1]++;
+        result->attackHistogram[attackBin < COLUMN_BINS - 1 ? attackBin : COLUMN_BINS - 1]++;
+    }
+}
+
+// Format into a chunk sink
+static void sinkPrintf(WriteChunkFunc write, void* ctx, const char* format, ...) {
+    char line[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if(length > 0) {
+        write(ctx, line, (size_t)length < sizeof(line) ? (size_t)length : sizeof(line) - 1);
+    }
+}
+
+// Print one histogram
+static void writeHistogram(const char* title, const int* bins, WriteChunkFunc write, void* ctx) {
+    sinkPrintf(write, ctx, "%s histogram:\n", title);
+    for(int b = 0; b < COLUMN_BINS; b++) {
+        if(b == COLUMN_BINS - 1) {
+            sinkPrintf(write, ctx, "%d+: %d\n", b * COLUMN_BIN_WIDTH, bins[b]);
+        } else {
+            sinkPrintf(write, ctx, "%d-%d: %d\n", b * COLUMN_BIN_WIDTH, (b + 1) * COLUMN_BIN_WIDTH - 1, bins[b]);
+        }
+    }
+}
+
+// Print aggregates
+void writeColumnAggregates(const ColumnAggregates* result, int rows, WriteChunkFunc write, void* ctx) {
+    sinkPrintf(write, ctx, "\n=== Type Statistics (%d Pokemon) ===\n", rows);
+    for(int t = 0; t < TYPE_COUNT; t++) {
+        const TypeAggregate* type = &result->types[t];
+        if(type->count) {
+            sinkPrintf(write, ctx, "%s: %d Pokemon, avg HP %.2f, avg Attack %.2f, max HP %d, max Attack %d\n",
+                       getTypeName((PokemonType)t), type->count, (double)type->hpSum / type->count,
+                       (double)type->attackSum / type->count, type->hpMax, type->attackMax);
+        }
+    }
+    writeHistogram("HP", result->hpHistogram, write, ctx);
+    writeHistogram("Attack", result->attackHistogram, write, ctx);
+}
+
+// Export menu entry
+void exportColumnsMenu(Registry* reg) {
+    printf("Export file: ");
+    char* path = getDynamicInput();
+    if(!path || !*path) {
+        printf("No file given.\n");
+        return;
+    }
+
+    PokedexColumns columns;
+    buildPokedexColumns(reg, &columns);
+    if(exportPokedexColumns(&columns, path)) {
+        printf("Exported %d Pokemon of %d owners to %s.\n", columns.rows, columns.owners, path);
+    }
+    freePokedexColumns(&columns);
+}
+
+// Type statistics menu entry
+void typeStatisticsMenu(Registry* reg) {
+    printf("Columns file (empty for the live registry): ");
+    char* path = getDynamicInput();
+    PokedexColumns columns;
+    if(path && *path) {
+        if(!loadPokedexColumns(path, &columns)) {
+            return;
         }
-        return insertPokemonNode(root->left, newNode);
     } else {
-        if(!root->right) {
-            root->right = newNode;
-            return newNode;
+        buildPokedexColumns(reg, &columns);
+    }
+
+    if(columns.rows == 0) {
+        printf("No Pokemon.\n");
+    } else {
+        ColumnAggregates result;
+        aggregatePokedexColumns(&columns, &result);
+        writeColumnAggregates(&result, columns.rows, writeToFile, stdout);
+    }
+    freePokedexColumns(&columns);
+}
+
+
+// SET OPERATION FUNCTIONS
+// In-order cursor over a version
+typedef struct {
+    PersistentNode** stack;
+    int size;
+    int capacity;
+} VersionCursor;
+
+// Push the left spine below a version node
+static void pushVersionSpine(VersionCursor* cursor, PersistentNode* node) {
+    for(; node; node = node->left) {
+        if(cursor->size == cursor->capacity) {
+            cursor->capacity = cursor->capacity ? cursor->capacity * 2 : 32;
+            cursor->stack = (PersistentNode**) realloc(cursor->stack, sizeof(PersistentNode*) * cursor->capacity);
         }
-        return insertPokemonNode(root->right, newNode);
+        cursor->stack[cursor->size++] = node;
     }
 }
 
-// Remove Pokemon from pokedex tree
-void removeNodeBST(PokemonNode* root, PokemonNode* parent, OwnerNode* owner, int id) {
+// Next Pokemon in ID order, NULL when done
+static const PokemonData* nextInVersion(VersionCursor* cursor) {
+    if(cursor->size == 0) {
+        return NULL;
+    }
+    PersistentNode* node = cursor->stack[--cursor->size];
+    pushVersionSpine(cursor, node->right);
+    return &node->data;
+}
+
+// Merge-style walk of both versions
+static int walkSetOperation(PersistentNode* a, PersistentNode* b, SetOperation op, VisitDataFunc visit) {
+    VersionCursor first = {NULL, 0, 0}, second = {NULL, 0, 0};
+    pushVersionSpine(&first, a);
+    pushVersionSpine(&second, b);
+    const PokemonData* x = nextInVersion(&first);
+    const PokemonData* y = nextInVersion(&second);
+
+    int count = 0;
+    while(x || y) {
+        if(!y || (x && x->id < y->id)) {
+            if(op != SET_INTERSECTION) {
+                visit(x);
+                count++;
+            }
+            x = nextInVersion(&first);
+        } else if(!x || y->id < x->id) {
+            if(op == SET_SYMMETRIC) {
+                visit(y);
+                count++;
+            }
+            y = nextInVersion(&second);
+        } else {
+            if(op == SET_INTERSECTION) {
+                visit(x);
+                count++;
+            }
+            x = nextInVersion(&first);
+            y = nextInVersion(&second);
+        }
+
+        // Only the symmetric difference needs the tail of the second
+        if(!x && op != SET_SYMMETRIC) {
+            break;
+        }
+    }
+
+    free(first.stack);
+    free(second.stack);
+    return count;
+}
+
+// Set the bit and table entry of every ID in a version
+static void markVersion(PersistentNode* root, int base, unsigned long long* bits, const PokemonData** table) {
     if(!root) {
         return;
     }
+    int at = root->data.id - base;
+    bits[at >> 6] |= 1ULL << (at & 63);
+    table[at] = &root->data;
+    markVersion(root->left, base, bits, table);
+    markVersion(root->right, base, bits, table);
+}
 
-    PokemonNode* temp;
-    InsertLocation location;
+// Word-at-a-time operation over ID bitsets
+static int bitsetSetOperation(PersistentNode* a, PersistentNode* b, int low, int high, SetOperation op, VisitDataFunc visit) {
+    int span = high - low + 1;
+    int words = (span + 63) / 64;
+    unsigned long long* bitsA = (unsigned long long*) calloc(words, sizeof(unsigned long long));
+    unsigned long long* bitsB = (unsigned long long*) calloc(words, sizeof(unsigned long long));
+    // Tables are only read where a bit is set, so they need no clearing
+    const PokemonData** tableA = (const PokemonData**) malloc(sizeof(PokemonData*) * span);
+    const PokemonData** tableB = (const PokemonData**) malloc(sizeof(PokemonData*) * span);
+    markVersion(a, low, bitsA, tableA);
+    markVersion(b, low, bitsB, tableB);
+
+    int count = 0;
+    for(int w = 0; w < words; w++) {
+        unsigned long long word = op == SET_INTERSECTION ? bitsA[w] & bitsB[w]
+                                  : op == SET_DIFFERENCE ? bitsA[w] & ~bitsB[w]
+                                  : bitsA[w] ^ bitsB[w];
+        // Lowest set bit first keeps ID order
+        while(word) {
+            int bit = __builtin_ctzll(word);
+            int at = w * 64 + bit;
+            visit((bitsA[w] >> bit) & 1 ? tableA[at] : tableB[at]);
+            count++;
+            word &= word - 1;
+        }
+    }
 
-    // Check if ID to remove is in this node
-    if(root->data->id == id) {
-        temp = root;
-        location = ROOT;
-    } else if(root->left && root->left->data->id == id) {
-        temp = root->left;
-        location = LEFT;
-    } else if(root->right && root->right->data->id == id) {
-        temp = root->right;
-        location = RIGHT;
-    // If ID not here iterate to next one based on ID
-    } else if(root->data->id > id) {
-        removeNodeBST(root->left, root, owner, id);
+    free(bitsA);
+    free(bitsB);
+    free(tableA);
+    free(tableB);
+    return count;
+}
+
+// Smallest or largest ID of a non-empty version
+static int extremeId(PersistentNode* root, int largest) {
+    while(largest ? root->right : root->left) {
+        root = largest ? root->right : root->left;
+    }
+    return root->data.id;
+}
+
+// Pick bitsets for dense ID spans, the walk otherwise
+int snapshotSetOperation(PersistentNode* a, PersistentNode* b, SetOperation op, VisitDataFunc visit) {
+    if(a && b) {
+        int low = extremeId(a, 0) < extremeId(b, 0) ? extremeId(a, 0) : extremeId(b, 0);
+        int high = extremeId(a, 1) > extremeId(b, 1) ? extremeId(a, 1) : extremeId(b, 1);
+        if((long long)high - low + 1 <= (long long)SET_DENSE_FACTOR * (a->size + b->size)) {
+            return bitsetSetOperation(a, b, low, high, op, visit);
+        }
+    }
+    return walkSetOperation(a, b, op, visit);
+}
+
+// Compare two named owners
+OpStatus registryCompareOwners(Registry* reg, const char* name1, const char* name2, SetOperation op,
+                               VisitDataFunc visit, int* count) {
+    *count = 0;
+    pthread_rwlock_rdlock(&reg->lock);
+    OwnerNode* owner1 = findOwnerByName(reg, name1);
+    OwnerNode* owner2 = findOwnerByName(reg, name2);
+    PersistentNode* a = owner1 && owner2 ? acquirePokedexSnapshot(owner1) : NULL;
+    PersistentNode* b = owner1 && owner2 ? acquirePokedexSnapshot(owner2) : NULL;
+    pthread_rwlock_unlock(&reg->lock);
+    if(!owner1 || !owner2) {
+        return OP_NOT_FOUND;
+    }
+
+    // Both versions are pinned, no lock is needed for the work itself
+    *count = snapshotSetOperation(a, b, op, visit);
+    releasePersistent(a);
+    releasePersistent(b);
+    return OP_OK;
+}
+
+// Compare menu entry
+void compareMenu(Registry* reg) {
+    // Validate owners exist
+    if(!reg->head || reg->head->next == reg->head) {
+        printf("Not enough owners to compare.\n");
         return;
-    } else {
-        removeNodeBST(root->right, root, owner, id);
+    }
+
+    // Get input
+    printf("\n=== Compare Pokedexes ===\n");
+    printf("Enter name of first owner: ");
+    // Second read reuses the scratch buffer, so keep a copy of the first
+    char* name1 = myStrdup(getDynamicInput());
+    printf("Enter name of second owner: ");
+    char* name2 = getDynamicInput();
+    printf("1. In both\n");
+    printf("2. Only in %s\n", name1);
+    printf("3. Only in %s\n", name2);
+    printf("4. In exactly one\n");
+    int choice = readIntSafe("Your choice: ");
+    if(choice < 1 || choice > 4) {
+        printf("Invalid choice.\n");
+        free(name1);
         return;
     }
 
-    // Wire correct node to parent of deleted node
-    if(temp->right) {
-        if(location == RIGHT) {
-            parent->right = temp->right;
-        } else if(location == LEFT) {
-            parent->left = temp->right;
-        } else {
-            owner->pokedexRoot = temp->right;
+    // "Only in second" is the difference taken the other way round
+    int count;
+    OpStatus status = choice == 3 ? registryCompareOwners(reg, name2, name1, SET_DIFFERENCE, printPokemonData, &count)
+                      : registryCompareOwners(reg, name1, name2, choice == 1 ? SET_INTERSECTION
+                                              : (choice == 2 ? SET_DIFFERENCE : SET_SYMMETRIC), printPokemonData, &count);
+    if(status != OP_OK) {
+        printf("One or both owners not found.\n");
+    } else if(count == 0) {
+        printf("No Pokemon.\n");
+    }
+
+    free(name1);
+}
+
+
+// NODE FOOTPRINT FUNCTIONS
+// Bytes as pointer nodes, allocator headers aside
+size_t pointerNodeBytes(int count) {
+    return (size_t)count * (sizeof(PokemonNode) + sizeof(PokemonData));
+}
+
+// Bytes of a frozen record and its pool
+size_t frozenPoolBytes(const FrozenPokedex* frozen) {
+    if(!frozen) {
+        return 0;
+    }
+    return sizeof(FrozenPokedex) + sizeof(CompactNode) * (size_t)(frozen->count + 1);
+}
+
+
+// REPLAY BENCHMARK FUNCTIONS
+// Append formatted input lines to a phase
+static void replayAppend(ReplayPhase* phase, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int needed = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    if(phase->length + needed + 1 > phase->capacity) {
+        size_t capacity = phase->capacity ? phase->capacity : 4096;
+        while(phase->length + needed + 1 > capacity) {
+            capacity *= 2;
         }
-        if(temp->left) {
-            insertPokemonNode(parent, temp->left);
+        phase->text = (char*) realloc(phase->text, capacity);
+        phase->capacity = capacity;
+    }
+
+    va_start(args, format);
+    vsnprintf(phase->text + phase->length, needed + 1, format, args);
+    va_end(args);
+    for(int i = 0; i < needed; i++) {
+        phase->lines += phase->text[phase->length + i] == '\n';
+    }
+    phase->length += needed;
+}
+
+// Start a new empty phase
+static ReplayPhase* replayPhase(ReplayScript* script, const char* name) {
+    ReplayPhase* phase = &script->phases[script->count++];
+    memset(phase, 0, sizeof(*phase));
+    snprintf(phase->name, sizeof(phase->name), "%s", name);
+    return phase;
+}
+
+// Next generator random number
+static unsigned int replayRandom(unsigned int* seed) {
+    *seed = *seed * 1103515245u + 12345u;
+    return *seed >> 8;
+}
+
+// Random ID present in a simulated Pokedex, 0 if empty
+static int replayPresentId(const unsigned char* present, int species, int size, unsigned int* seed) {
+    if(size == 0) {
+        return 0;
+    }
+    int skip = (int)(replayRandom(seed) % size);
+    for(int id = 1; id <= species; id++) {
+        if(present[id] && skip-- == 0) {
+            return id;
         }
-    } else if (temp->left) {
-        if(location == RIGHT) {
-            parent->right = temp->left;
-        } else if(location == LEFT) {
-            parent->left = temp->left;
-        } else {
-            owner->pokedexRoot = temp->left;
+    }
+    return 0;
+}
+
+// Generate a full session split in phases
+int generateReplayScript(ReplayScript* script, int owners, int adds, unsigned int seed) {
+    memset(script, 0, sizeof(*script));
+    int species = speciesCount();
+    if(owners < 2 || adds < 0 || species < 7) {
+        fprintf(stderr, "Replay needs at least 2 owners and 7 species.\n");
+        return 0;
+    }
+
+    // Simulated Pokedex of every owner, in list order
+    unsigned char* present = (unsigned char*) calloc((size_t)owners * (species + 1), 1);
+    int* sizes = (int*) calloc(owners, sizeof(int));
+    char (*names)[REPLAY_NAME] = malloc(sizeof(*names) * owners);
+
+    // Create, names are unique but not sorted
+    ReplayPhase* phase = replayPhase(script, "create");
+    for(int i = 0; i < owners; i++) {
+        int starter = 1 + i % 3;
+        snprintf(names[i], REPLAY_NAME, "T%08x", (unsigned int)(i + 1) * 2654435761u);
+        replayAppend(phase, "1\n%s\n%d\n", names[i], starter);
+        present[(size_t)i * (species + 1) + 3 * starter - 2] = 1;
+        sizes[i] = 1;
+        phase->commands++;
+    }
+    replayAppend(phase, "7\n");
+
+    // Add, duplicates included like a real user
+    phase = replayPhase(script, "add");
+    for(int i = 0; i < owners; i++) {
+        unsigned char* mine = present + (size_t)i * (species + 1);
+        replayAppend(phase, "2\n%d\n", i + 1);
+        for(int a = 0; a < adds; a++) {
+            int id = 1 + (int)(replayRandom(&seed) % species);
+            replayAppend(phase, "1\n%d\n", id);
+            if(!mine[id]) {
+                mine[id] = 1;
+                sizes[i]++;
+            }
+        }
+        replayAppend(phase, "6\n");
+        phase->commands += adds + 2;
+    }
+    replayAppend(phase, "7\n");
+
+    // Display in every order
+    phase = replayPhase(script, "display");
+    for(int i = 0; i < owners; i++) {
+        replayAppend(phase, "2\n%d\n", i + 1);
+        for(int order = 1; order <= 6; order++) {
+            replayAppend(phase, "2\n%d\n", order);
+        }
+        replayAppend(phase, "6\n");
+        phase->commands += 8;
+    }
+    replayAppend(phase, "7\n");
+
+    // Fight, mostly Pokemon that are there
+    phase = replayPhase(script, "fight");
+    int fights = adds / 4 + 1;
+    for(int i = 0; i < owners; i++) {
+        unsigned char* mine = present + (size_t)i * (species + 1);
+        replayAppend(phase, "2\n%d\n", i + 1);
+        for(int f = 0; f < fights; f++) {
+            int first = replayPresentId(mine, species, sizes[i], &seed);
+            int second = f % 4 == 3 ? 1 + (int)(replayRandom(&seed) % species)
+                                    : replayPresentId(mine, species, sizes[i], &seed);
+            replayAppend(phase, "4\n%d\n%d\n", first, second);
+        }
+        replayAppend(phase, "6\n");
+        phase->commands += fights + 2;
+    }
+    replayAppend(phase, "7\n");
+
+    // Release and evolve, never emptying a Pokedex
+    phase = replayPhase(script, "release");
+    for(int i = 0; i < owners; i++) {
+        unsigned char* mine = present + (size_t)i * (species + 1);
+        replayAppend(phase, "2\n%d\n", i + 1);
+        phase->commands += 2;
+        for(int r = 0; r < fights && sizes[i] > 1; r++) {
+            int id = replayPresentId(mine, species, sizes[i], &seed);
+            // A species without a next one in the catalog is only released
+            int evolves = getSpecies(id)->CAN_EVOLVE == CAN_EVOLVE;
+            if(r % 2 == 0 || (evolves && !getSpecies(id + 1))) {
+                replayAppend(phase, "3\n%d\n", id);
+                mine[id] = 0;
+                sizes[i]--;
+            } else {
+                replayAppend(phase, "5\n%d\n", id);
+                if(evolves) {
+                    mine[id] = 0;
+                    sizes[i]--;
+                    if(!mine[id + 1]) {
+                        mine[id + 1] = 1;
+                        sizes[i]++;
+                    }
+                }
+            }
+            phase->commands++;
+        }
+        replayAppend(phase, "6\n");
+    }
+    replayAppend(phase, "7\n");
+
+    // Merge neighbours, the second of each pair goes away
+    phase = replayPhase(script, "merge");
+    int merges = owners / 4 > 0 ? owners / 4 : 1;
+    for(int m = 0; m < merges; m++) {
+        replayAppend(phase, "4\n%s\n%s\n", names[2 * m], names[2 * m + 1]);
+        phase->commands++;
+    }
+    replayAppend(phase, "7\n");
+    int alive = owners - merges;
+
+    // Sort, then walk the circle both ways
+    phase = replayPhase(script, "sort");
+    replayAppend(phase, "5\n6\nF\n%d\n6\nB\n%d\n7\n", 2 * alive, 2 * alive);
+    phase->commands += 3;
+
+    // Delete half of what is left
+    phase = replayPhase(script, "delete");
+    for(int d = alive / 2; d > 0; d--) {
+        replayAppend(phase, "3\n%d\n", 1 + (int)(replayRandom(&seed) % alive));
+        alive--;
+        phase->commands++;
+    }
+    replayAppend(phase, "7\n");
+
+    free(present);
+    free(sizes);
+    free(names);
+    return 1;
+}
+
+// Load one recorded session
+int loadReplayScript(const char* path, ReplayScript* script) {
+    memset(script, 0, sizeof(*script));
+    FILE* file = fopen(path, "r");
+    if(!file) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return 0;
+    }
+
+    // Menu choices cannot be told from names and IDs without running the menus
+    ReplayPhase* phase = replayPhase(script, "script");
+    phase->commands = -1;
+    char line[256];
+    while(fgets(line, sizeof(line), file)) {
+        replayAppend(phase, "%s", line);
+    }
+    fclose(file);
+    return 1;
+}
+
+// Save phases as one session with a single exit
+int saveReplayScript(const ReplayScript* script, const char* path) {
+    FILE* file = fopen(path, "w");
+    if(!file) {
+        fprintf(stderr, "Cannot write %s\n", path);
+        return 0;
+    }
+
+    for(int i = 0; i < script->count; i++) {
+        const ReplayPhase* phase = &script->phases[i];
+        // Every phase ends with "7\n", drop it
+        size_t length = phase->length >= 2 ? phase->length - 2 : 0;
+        fwrite(phase->text, 1, length, file);
+    }
+    fputs("7\n", file);
+    return fclose(file) == 0;
+}
+
+// Free every phase
+void freeReplayScript(ReplayScript* script) {
+    for(int i = 0; i < script->count; i++) {
+        free(script->phases[i].text);
+    }
+    script->count = 0;
+}
+
+// One report row, commands and their rate are "-" when unknown
+static void replayReportRow(FILE* report, const char* name, long commands, long lines, double seconds) {
+    char count[24] = "-", rate[24] = "-";
+    if(commands >= 0) {
+        snprintf(count, sizeof(count), "%ld", commands);
+        snprintf(rate, sizeof(rate), "%.0f", seconds > 0 ? commands / seconds : 0);
+    }
+    fprintf(report, "%-10s %10s %10ld %10.3f %12s %12.0f\n", name, count, lines, seconds, rate,
+            seconds > 0 ? lines / seconds : 0);
+}
+
+// Run phases through the main menu
+int runReplayScript(Registry* reg, const ReplayScript* script, FILE* report) {
+    char path[] = "/tmp/ex6-replay-XXXXXX";
+    int fd = mkstemp(path);
+    if(fd < 0) {
+        fprintf(report, "Cannot create replay file.\n");
+        return 1;
+    }
+    close(fd);
+
+    // Output of the menus goes nowhere
+    fflush(stdout);
+    if(!freopen("/dev/null", "w", stdout)) {
+        fprintf(report, "Cannot redirect output.\n");
+        unlink(path);
+        return 1;
+    }
+
+    int status = 0;
+    long commands = 0, lines = 0;
+    double total = 0;
+    fprintf(report, "%-10s %10s %10s %10s %12s %12s\n", "Phase", "Commands", "Lines", "Seconds",
+            "Commands/s", "Lines/s");
+    for(int i = 0; i < script->count && status == 0; i++) {
+        const ReplayPhase* phase = &script->phases[i];
+        FILE* file = fopen(path, "w");
+        if(!file || fwrite(phase->text, 1, phase->length, file) != phase->length) {
+            status = 1;
         }
-    } else {
-        if(location == RIGHT) {
-            parent->right = NULL;
-        } else if(location == LEFT) {
-            parent->left = NULL;
-        } else {
-            owner->pokedexRoot = NULL;
+        if(file && fclose(file) != 0) {
+            status = 1;
         }
+        if(status || !freopen(path, "r", stdin)) {
+            fprintf(report, "Cannot feed phase %s.\n", phase->name);
+            status = 1;
+            break;
+        }
+
+        double start = nowMicros();
+        mainMenu(reg);
+        fflush(stdout);
+        double elapsed = (nowMicros() - start) / 1e6;
+
+        replayReportRow(report, phase->name, phase->commands, phase->lines, elapsed);
+        commands = commands >= 0 && phase->commands >= 0 ? commands + phase->commands : -1;
+        lines += phase->lines;
+        total += elapsed;
+    }
+    if(status == 0) {
+        replayReportRow(report, "total", commands, lines, total);
     }
 
-    // Clear and free node
-    temp->right = NULL;
-    temp->left = NULL;
-    freePokemonNode(temp);
+    unlink(path);
+    return status;
 }
 
-// Rewire owners list for a new owner
-void linkOwnerInCircularList(OwnerNode* newOwner) {
-    // If this is the first make it head
-    if(!ownerHead) {
-        newOwner->next = newOwner;
-        newOwner->prev = newOwner;
-        ownerHead = newOwner;
-    } else {
-        ownerHead->prev->next = newOwner;
-        newOwner->prev = ownerHead->prev;
-        ownerHead->prev = newOwner;
-        newOwner->next = ownerHead;
+
+// BEST COUNTER FUNCTIONS
+// Attacker rows, defender columns, both in PokemonType order:
+// GRASS FIRE WATER BUG NORMAL POISON ELECTRIC GROUND FAIRY FIGHTING PSYCHIC ROCK GHOST DRAGON ICE
+static const double typeChart[TYPE_COUNT][TYPE_COUNT] = {
+    /* GRASS    */ {0.5, 0.5, 2.0, 0.5, 1.0, 0.5, 1.0, 2.0, 1.0, 1.0, 1.0, 2.0, 1.0, 0.5, 1.0},
+    /* FIRE     */ {2.0, 0.5, 0.5, 2.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 0.5, 1.0, 0.5, 2.0},
+    /* WATER    */ {0.5, 2.0, 0.5, 1.0, 1.0, 1.0, 1.0, 2.0, 1.0, 1.0, 1.0, 2.0, 1.0, 0.5, 1.0},
+    /* BUG      */ {2.0, 0.5, 1.0, 1.0, 1.0, 0.5, 1.0, 1.0, 0.5, 0.5, 2.0, 1.0, 0.5, 1.0, 1.0},
+    /* NORMAL   */ {1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 0.5, 0.0, 1.0, 1.0},
+    /* POISON   */ {2.0, 1.0, 1.0, 1.0, 1.0, 0.5, 1.0, 0.5, 2.0, 1.0, 1.0, 0.5, 0.5, 1.0, 1.0},
+    /* ELECTRIC */ {0.5, 1.0, 2.0, 1.0, 1.0, 1.0, 0.5, 0.0, 1.0, 1.0, 1.0, 1.0, 1.0, 0.5, 1.0},
+    /* GROUND   */ {0.5, 2.0, 1.0, 0.5, 1.0, 2.0, 2.0, 1.0, 1.0, 1.0, 1.0, 2.0, 1.0, 1.0, 1.0},
+    /* FAIRY    */ {1.0, 0.5, 1.0, 1.0, 1.0, 0.5, 1.0, 1.0, 1.0, 2.0, 1.0, 1.0, 1.0, 2.0, 1.0},
+    /* FIGHTING */ {1.0, 1.0, 1.0, 0.5, 2.0, 0.5, 1.0, 1.0, 0.5, 1.0, 0.5, 2.0, 0.0, 1.0, 2.0},
+    /* PSYCHIC  */ {1.0, 1.0, 1.0, 1.0, 1.0, 2.0, 1.0, 1.0, 1.0, 2.0, 0.5, 1.0, 1.0, 1.0, 1.0},
+    /* ROCK     */ {1.0, 2.0, 1.0, 2.0, 1.0, 1.0, 1.0, 0.5, 1.0, 0.5, 1.0, 1.0, 1.0, 1.0, 2.0},
+    /* GHOST    */ {1.0, 1.0, 1.0, 1.0, 0.0, 1.0, 1.0, 1.0, 1.0, 1.0, 2.0, 1.0, 2.0, 1.0, 1.0},
+    /* DRAGON   */ {1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 0.0, 1.0, 1.0, 1.0, 1.0, 2.0, 1.0},
+    /* ICE      */ {2.0, 0.5, 0.5, 1.0, 1.0, 1.0, 1.0, 2.0, 1.0, 1.0, 1.0, 1.0, 1.0, 2.0, 0.5},
+};
+
+// Chart lookup
+double typeEffectiveness(PokemonType attacker, PokemonType defender) {
+    if((int)attacker < 0 || attacker >= TYPE_COUNT || (int)defender < 0 || defender >= TYPE_COUNT) {
+        return 1.0;
     }
+    return typeChart[attacker][defender];
+}
 
-    return;
+// Offense and defense multipliers of a type against a target
+static void counterFactors(PokemonType type, const PokemonData* target, double* offense, double* defense) {
+    double resist = typeEffectiveness(target->TYPE, type);
+    *offense = typeEffectiveness(type, target->TYPE);
+    *defense = 1.0 / (resist > COUNTER_MIN_RESIST ? resist : COUNTER_MIN_RESIST);
 }
 
-// Rewire owners to remove owner
-void removeOwnerFromCircularList(OwnerNode* owner) {
-    // If removed owner is the head
-    if(ownerHead == owner) {
-        // If this is the only owner
-        if(owner->next == owner) {
-            ownerHead = NULL;
-        } else {
-            // Rewire new head
-            owner->prev->next = owner->next;
-            owner->next->prev = owner->prev;
-            ownerHead = owner->next;
-        }
-    } else {
-        // Rewire first and last owners
-        owner->prev->next = owner->next;
-        owner->next->prev = owner->prev;
+// Score one candidate
+double counterScore(const PokemonData* candidate, const PokemonData* target) {
+    double offense, defense;
+    counterFactors(candidate->TYPE, target, &offense, &defense);
+    return (candidate->attack * 1.5 * offense) + (candidate->hp * 1.2 * defense);
+}
+
+// Count every type in a tree
+static void countTypes(const PokemonNode* node, int* counts) {
+    if(!node) {
+        return;
+    }
+    counts[node->data->TYPE]++;
+    countTypes(node->left, counts);
+    countTypes(node->right, counts);
+}
+
+// Place every Pokemon in its type group
+static void placeByType(const PokemonNode* node, PokemonData* data, int* next) {
+    if(!node) {
+        return;
     }
+    data[next[node->data->TYPE]++] = *node->data;
+    placeByType(node->left, data, next);
+    placeByType(node->right, data, next);
 }
 
+// Build counter index of a tree
+static CounterIndex* buildCounterIndex(const PokemonNode* root) {
+    int counts[TYPE_COUNT] = {0};
+    countTypes(root, counts);
+
+    CounterIndex* index = (CounterIndex*) malloc(sizeof(CounterIndex));
+    int next[TYPE_COUNT];
+    index->start[0] = 0;
+    for(int t = 0; t < TYPE_COUNT; t++) {
+        next[t] = index->start[t];
+        index->start[t + 1] = index->start[t] + counts[t];
+    }
+    index->capacity = index->start[TYPE_COUNT] + 1;
+    index->data = (PokemonData*) malloc(sizeof(PokemonData) * index->capacity);
+    placeByType(root, index->data, next);
+    for(int t = 0; t < TYPE_COUNT; t++) {
+        qsort(index->data + index->start[t], counts[t], sizeof(PokemonData), compareFightScore);
+    }
+    index->refs = 1;
+    return index;
+}
 
-// SUB-MENUS
-// Enter owner pokedex
-void enterExistingPokedexMenu() {
-    // Validate owners exist
-    if(!ownerHead) {
-        printf("No existing Pokedexes.\n");
+// Free counter index with the last reference
+void releaseCounterIndex(CounterIndex* index) {
+    if(!index || __atomic_sub_fetch(&index->refs, 1, __ATOMIC_ACQ_REL) != 0) {
         return;
     }
+    free(index->data);
+    free(index);
+}
 
-    // Print all owners
-    printf("\nExisting Pokedexes:\n");
-    printAllOwners();
+// Reference the counter index, built on first use after a write
+CounterIndex* acquireCounterIndex(OwnerNode* owner) {
+    pthread_mutex_lock(&owner->lock);
+    if(!owner->counters && owner->pokedexRoot) {
+        owner->counters = buildCounterIndex(owner->pokedexRoot);
+    }
+    CounterIndex* index = owner->counters;
+    if(index) {
+        __atomic_add_fetch(&index->refs, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&owner->lock);
 
-    // Get input
-    int index = readIntSafe("Choose a Pokedex by number:");
+    return index;
+}
 
-    // Find requested owner
-    OwnerNode* owner = findOwnerByIndex(index);
+// Better pick first
+static int counterBefore(double score1, int id1, double score2, int id2) {
+    return score1 > score2 || (score1 == score2 && id1 < id2);
+}
 
-    printf("\nEntering %s's Pokedex...\n", owner->ownerName);
+// Top k counters, type groups cut off by their bound
+int bestCounters(const CounterIndex* index, const PokemonData* target, CounterPick* picks, int k, int* scored) {
+    int found = 0, tried = 0;
+    k = k > COUNTER_MAX ? COUNTER_MAX : k;
+    if(!index || k <= 0) {
+        if(scored) {
+            *scored = 0;
+        }
+        return 0;
+    }
 
-    int subChoice;
-    do {
-        // Pokedex menu
-        printf("\n-- %s's Pokedex Menu --\n", owner->ownerName);
-        printf("1. Add Pokemon\n");
-        printf("2. Display Pokedex\n");
-        printf("3. Release Pokemon (by ID)\n");
-        printf("4. Pokemon Fight!\n");
-        printf("5. Evolve Pokemon\n");
-        printf("6. Back to Main\n");
-        // Get input
-        subChoice = readIntSafe("Your choice: ");
+    // Groups with the highest bound go first so the list fills with strong picks
+    int order[TYPE_COUNT];
+    double factors[TYPE_COUNT], bounds[TYPE_COUNT];
+    for(int t = 0; t < TYPE_COUNT; t++) {
+        double offense, defense;
+        counterFactors((PokemonType)t, target, &offense, &defense);
+        factors[t] = offense > defense ? offense : defense;
+        const PokemonData* best = &index->data[index->start[t]];
+        bounds[t] = index->start[t] < index->start[t + 1] ? factors[t] * ((best->attack * 1.5) + (best->hp * 1.2)) : -1;
+
+        int at = t;
+        while(at > 0 && bounds[order[at - 1]] < bounds[t]) {
+            order[at] = order[at - 1];
+            at--;
+        }
+        order[at] = t;
+    }
 
-        // Direct function base on input
-        switch(subChoice) {
-        case 1:
-            addPokemon(owner);
-            break;
-        case 2:
-            displayMenu(owner);
-            break;
-        case 3:
-            freePokemon(owner);
-            break;
-        case 4:
-            pokemonFight(owner);
-            break;
-        case 5:
-            evolvePokemon(owner);
-            break;
-        case 6:
-            printf("Back to Main Menu.\n");
-            break;
-        default:
-            printf("Invalid choice.\n");
+    for(int g = 0; g < TYPE_COUNT; g++) {
+        int t = order[g];
+        double factor = factors[t];
+        for(int i = index->start[t]; i < index->start[t + 1]; i++) {
+            const PokemonData* data = &index->data[i];
+            // Nothing further down this group can enter a full list
+            double bound = factor * ((data->attack * 1.5) + (data->hp * 1.2));
+            if(found == k && bound + 1e-9 < picks[k - 1].score) {
+                break;
+            }
+            double score = counterScore(data, target);
+            tried++;
+            if(found == k && !counterBefore(score, data->id, picks[k - 1].score, picks[k - 1].data.id)) {
+                continue;
+            }
+
+            // Insertion into the short sorted list
+            int at = found < k ? found++ : k - 1;
+            while(at > 0 && counterBefore(score, data->id, picks[at - 1].score, picks[at - 1].data.id)) {
+                picks[at] = picks[at - 1];
+                at--;
+            }
+            picks[at].data = *data;
+            picks[at].score = score;
         }
-    } while(subChoice != 6);
+    }
+
+    if(scored) {
+        *scored = tried;
+    }
+    return found;
 }
 
-// Display Pokemons in pokedex
-void displayMenu(OwnerNode* owner) {
+// Best counter menu entry
+void bestCounterMenu(OwnerNode* owner) {
     // Validate pokedex exist
-    if (!owner->pokedexRoot) {
+    if(!owner->pokedexRoot) {
         printf("Pokedex is empty.\n");
         return;
     }
 
-    printf("Display:\n");
-    printf("1. BFS (Level-Order)\n");
-    printf("2. Pre-Order\n");
-    printf("3. In-Order\n");
-    printf("4. Post-Order\n");
-    printf("5. Alphabetical (by name)\n");
-    // Get input
-    int choice = readIntSafe("Your choice: ");
+    int id = readSpeciesIdSafe("Enter ID of the challenger: ");
+    const PokemonData* target = getSpecies(id);
+    if(!target) {
+        // Zero was already reported while reading
+        if(id) {
+            printf("Invalid ID.\n");
+        }
+        return;
+    }
+    int k = readIntSafe("How many counters? ");
+    if(k < 1 || k > COUNTER_MAX) {
+        printf("Choose 1 to %d.\n", COUNTER_MAX);
+        return;
+    }
 
-    // Direct display type base on input
-    switch (choice) {
-    case 1:
-        displayBFS(owner->pokedexRoot);
-        break;
-    case 2:
-        preOrderTraversal(owner->pokedexRoot);
-        break;
-    case 3:
-        inOrderTraversal(owner->pokedexRoot);
-        break;
-    case 4:
-        postOrderTraversal(owner->pokedexRoot);
-        break;
-    case 5:
-        displayAlphabetical(owner->pokedexRoot);
-        break;
-    default:
-        printf("Invalid choice.\n");
+    CounterPick picks[COUNTER_MAX];
+    int scored;
+    CounterIndex* index = acquireCounterIndex(owner);
+    int found = bestCounters(index, target, picks, k, &scored);
+    int total = index ? index->start[TYPE_COUNT] : 0;
+    releaseCounterIndex(index);
+
+    printf("Best counters against %s (%s):\n", target->name, getTypeName(target->TYPE));
+    for(int i = 0; i < found; i++) {
+        printf("%d. %s (ID %d, %s) Score = %.2f\n", i + 1, picks[i].data.name, picks[i].data.id,
+               getTypeName(picks[i].data.TYPE), picks[i].score);
     }
+    printf("Scored %d of %d Pokemon.\n", scored, total);
 }
 
 
-// CREATE AND FREE
-// Create a new owner
-OwnerNode* createOwner(char* ownerName, PokemonNode* starter) {
-    // Allocate memory for new owner
-    OwnerNode* newOwner = (OwnerNode*) malloc(sizeof(OwnerNode));
+// TEAM OPTIMIZER FUNCTIONS
+// Shared state of one team search
+typedef struct TeamSearch {
+    const PokemonData** candidates;  // Best fight score first
+    long* scores;                    // Tenths, same order
+    long* prefix;                    // prefix[i] = scores[0] + ... + scores[i - 1]
+    int lastOfType[TYPE_COUNT];      // Last candidate of each type, -1 if none
+    int count;
+    TeamConstraints constraints;
+    long best;                       // Best score of any worker, atomic
+    int nextBranch;                  // Next first member to try, atomic
+} TeamSearch;
+
+// Best team of one worker
+typedef struct TeamWorker {
+    int members[TEAM_SIZE];
+    int size;
+    long score;
+    long nodes;
+    // Current partial team
+    int path[TEAM_SIZE];
+    int typeCount[TYPE_COUNT];
+} TeamWorker;
+
+// Add every named type to a mask
+int addCoverTypes(char* text, unsigned int* mask) {
+    char* save;
+    for(char* name = strtok_r(text, " \t", &save); name; name = strtok_r(NULL, " \t", &save)) {
+        PokemonType type;
+        if(!parseCatalogType(name, strlen(name), &type)) {
+            return 0;
+        }
+        *mask |= 1u << type;
+    }
+    return 1;
+}
 
-    // Insert new owner data
-    newOwner->ownerName = ownerName;
-    newOwner->pokedexRoot = starter;
+// Best fight score first, lower ID on ties
+static int compareTeamCandidates(const void* a, const void* b) {
+    const PokemonData* first = *(const PokemonData* const*) a;
+    const PokemonData* second = *(const PokemonData* const*) b;
+    long score1 = 15L * first->attack + 12L * first->hp;
+    long score2 = 15L * second->attack + 12L * second->hp;
+    if(score1 != score2) {
+        return score1 > score2 ? -1 : 1;
+    }
+    return (first->id > second->id) - (first->id < second->id);
+}
 
-    // Add new owner to the list
-    linkOwnerInCircularList(newOwner);
-    printf("New Pokedex created for %s with starter %s.\n", newOwner->ownerName, starter->data->name);
-    
-    return newOwner;
+// Earlier team in search order, a team comes before its extensions
+static int teamBefore(const TeamWorker* first, const TeamWorker* second) {
+    for(int i = 0; i < first->size && i < second->size; i++) {
+        if(first->members[i] != second->members[i]) {
+            return first->members[i] < second->members[i];
+        }
+    }
+    return first->size < second->size;
 }
 
-// Free owner data
-void freeOwnerNode(OwnerNode* owner) {
-    // Rewire owners list to remove owner
-    removeOwnerFromCircularList(owner);
+// Raise the shared best score
+static void raiseTeamBest(TeamSearch* search, long score) {
+    long best = __atomic_load_n(&search->best, __ATOMIC_RELAXED);
+    while(score > best && !__atomic_compare_exchange_n(&search->best, &best, score, 1,
+                                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
 
-    // Free all owner data
-    freePokemonNode(owner->pokedexRoot);
-    free(owner->ownerName);
-    free(owner);
+// Extend a partial team with candidates from next on
+static void searchTeam(TeamSearch* search, TeamWorker* worker, int size, int next, long score, unsigned int covered) {
+    worker->nodes++;
+    unsigned int missing = search->constraints.coverMask & ~covered;
+    // Keep the first team of the best score, it has the lowest members
+    if(!missing && score > worker->score) {
+        worker->score = score;
+        worker->size = size;
+        memcpy(worker->members, worker->path, sizeof(int) * size);
+        raiseTeamBest(search, score);
+    }
+    if(size == TEAM_SIZE || __builtin_popcount(missing) > TEAM_SIZE - size) {
+        return;
+    }
+
+    int slots = TEAM_SIZE - size;
+    for(int i = next; i < search->count; i++) {
+        // The bound only shrinks further down the list
+        int end = i + slots < search->count ? i + slots : search->count;
+        long bound = score + search->prefix[end] - search->prefix[i];
+        if(bound < __atomic_load_n(&search->best, __ATOMIC_RELAXED) || bound <= worker->score) {
+            break;
+        }
+        // A missing type with no candidate left cannot be covered any more
+        int stranded = 0;
+        for(unsigned int rest = missing; rest && !stranded; rest &= rest - 1) {
+            stranded = search->lastOfType[__builtin_ctz(rest)] < i;
+        }
+        if(stranded) {
+            break;
+        }
+
+        int type = search->candidates[i]->TYPE;
+        if(search->constraints.maxPerType && worker->typeCount[type] >= search->constraints.maxPerType) {
+            continue;
+        }
+        worker->path[size] = i;
+        worker->typeCount[type]++;
+        searchTeam(search, worker, size + 1, i + 1, score + search->scores[i], covered | 1u << type);
+        worker->typeCount[type]--;
+    }
 }
 
-// Create a new Pokemon node
-PokemonNode* createPokemonNode(PokemonData* data) {
-    // Allocate memory for new Pokemon
-    PokemonNode* pokemon = malloc(sizeof(PokemonNode));
-    // Insert new Pokemon data
-    pokemon->data = data;
-    pokemon->left = NULL;
-    pokemon->right = NULL;
+// Pool task, chunks are just workers: first members are claimed one by one
+// because the branches of the strongest candidates are far larger
+static void teamChunkTask(OwnerNode** owners, int begin, int end, void* ctx, void* result) {
+    (void)owners;
+    (void)begin;
+    (void)end;
+    TeamSearch* search = (TeamSearch*) ctx;
+    TeamWorker* worker = (TeamWorker*) result;
+    worker->score = -1;
+
+    int first;
+    while((first = __atomic_fetch_add(&search->nextBranch, 1, __ATOMIC_RELAXED)) < search->count) {
+        // Branch holds teams whose best member is candidate first, later ones reach less
+        int end = first + TEAM_SIZE < search->count ? first + TEAM_SIZE : search->count;
+        long bound = search->prefix[end] - search->prefix[first];
+        if(bound < __atomic_load_n(&search->best, __ATOMIC_RELAXED) || bound <= worker->score) {
+            break;
+        }
+        int type = search->candidates[first]->TYPE;
+        worker->path[0] = first;
+        worker->typeCount[type]++;
+        searchTeam(search, worker, 1, first + 1, search->scores[first], 1u << type);
+        worker->typeCount[type]--;
+    }
+}
 
-    return pokemon;
+// Branch and bound over the sorted candidates
+OpStatus searchBestTeam(ThreadPool* pool, PersistentNode* snapshot,
+                        const TeamConstraints* constraints, TeamResult* result) {
+    memset(result, 0, sizeof(*result));
+    int count = 0;
+    if(!snapshot) {
+        return OP_EMPTY;
+    }
+    if(constraints->maxPerType < 0) {
+        return OP_INVALID;
+    }
+
+    // Sorted candidates with prefix sums of their scores
+    TeamSearch search;
+    memset(&search, 0, sizeof(search));
+    search.candidates = (const PokemonData**) malloc(sizeof(PokemonData*) * snapshot->size);
+    collectPersistent(snapshot, search.candidates, &count);
+    qsort(search.candidates, count, sizeof(PokemonData*), compareTeamCandidates);
+    search.scores = (long*) malloc(sizeof(long) * count);
+    search.prefix = (long*) malloc(sizeof(long) * (count + 1));
+    search.prefix[0] = 0;
+    for(int t = 0; t < TYPE_COUNT; t++) {
+        search.lastOfType[t] = -1;
+    }
+    for(int i = 0; i < count; i++) {
+        search.scores[i] = 15L * search.candidates[i]->attack + 12L * search.candidates[i]->hp;
+        search.prefix[i + 1] = search.prefix[i] + search.scores[i];
+        search.lastOfType[search.candidates[i]->TYPE] = i;
+    }
+    search.count = count;
+    search.constraints = *constraints;
+    search.best = -1;
+
+    // Too many types to cover, or one nobody has, needs no search
+    int possible = __builtin_popcount(constraints->coverMask) <= TEAM_SIZE;
+    for(int t = 0; t < TYPE_COUNT; t++) {
+        if((constraints->coverMask >> t & 1u) && search.lastOfType[t] < 0) {
+            possible = 0;
+        }
+    }
+    if(!possible) {
+        search.count = 0;
+    }
+
+    // One chunk per worker, the caller included
+    int chunks = 1;
+    TeamWorker* workers;
+    if(pool) {
+        workers = (TeamWorker*) parallelForOwners(pool, NULL, pool->threadCount + 1, teamChunkTask,
+                                                  &search, sizeof(TeamWorker), &chunks);
+    } else {
+        workers = (TeamWorker*) calloc(1, sizeof(TeamWorker));
+        teamChunkTask(NULL, 0, 1, &search, workers);
+    }
+
+    // Best score wins, then the team with the lower members
+    TeamWorker* best = NULL;
+    for(int i = 0; i < chunks; i++) {
+        result->nodes += workers[i].nodes;
+        if(workers[i].score >= 0 && (!best || workers[i].score > best->score
+                                     || (workers[i].score == best->score && teamBefore(&workers[i], best)))) {
+            best = &workers[i];
+        }
+    }
+    if(best) {
+        result->size = best->size;
+        result->score = best->score / 10.0;
+        for(int i = 0; i < best->size; i++) {
+            result->members[i] = *search.candidates[best->members[i]];
+        }
+    }
+
+    free(workers);
+    free(search.candidates);
+    free(search.scores);
+    free(search.prefix);
+    return best ? OP_OK : OP_INVALID;
 }
 
-// Free Pokemon data
-void freePokemonNode(PokemonNode* node) {
-    if(!node) {
+// Best team of a named owner
+OpStatus registryBestTeam(Registry* reg, const char* name, const TeamConstraints* constraints, TeamResult* result) {
+    pthread_rwlock_rdlock(&reg->lock);
+    OwnerNode* owner = findOwnerByName(reg, name);
+    PersistentNode* snapshot = owner ? acquirePokedexSnapshot(owner) : NULL;
+    pthread_rwlock_unlock(&reg->lock);
+    if(!owner) {
+        return OP_NOT_FOUND;
+    }
+
+    OpStatus status = searchBestTeam(reg->pool, snapshot, constraints, result);
+    releasePersistent(snapshot);
+    return status;
+}
+
+// Best team menu entry
+void bestTeamMenu(Registry* reg, OwnerNode* owner) {
+    // Validate pokedex exist
+    if(!owner->pokedexRoot) {
+        printf("Pokedex is empty.\n");
         return;
     }
-    // Check left
-    if(node->left) {
-        // Free tree from left
-        freePokemonNode(node->left);
-        node->left = NULL;
+
+    TeamConstraints constraints = {0, 0};
+    constraints.maxPerType = readIntSafe("Most of one type (0 = no limit): ");
+    printf("Types to cover (names separated by spaces, empty for none): ");
+    int known = addCoverTypes(getDynamicInput(), &constraints.coverMask);
+    if(constraints.maxPerType < 0 || !known) {
+        printf("Invalid constraints.\n");
+        return;
     }
-    // Check right
-    if(node->right) {
-        // Free tree from right
-        freePokemonNode(node->right);
-        node->right = NULL;
+
+    TeamResult team;
+    PersistentNode* snapshot = acquirePokedexSnapshot(owner);
+    OpStatus status = searchBestTeam(reg->pool, snapshot, &constraints, &team);
+    releasePersistent(snapshot);
+    if(status != OP_OK) {
+        printf("No team meets these constraints.\n");
+        return;
     }
-    // Free node and data
-    free(node->data);
-    free(node);
 
-    return;
+    printf("Best team (Score = %.2f):\n", team.score);
+    for(int i = 0; i < team.size; i++) {
+        printf("%d. %s (ID %d, %s) Score = %.2f\n", i + 1, team.members[i].name, team.members[i].id,
+               getTypeName(team.members[i].TYPE), (team.members[i].attack * 1.5) + (team.members[i].hp * 1.2));
+    }
+    printf("Searched %ld partial teams.\n", team.nodes);
 }
 
+
 // --------------------------------------------------------------
 // Main Menu
 // --------------------------------------------------------------
-void mainMenu() {
+void mainMenu(Registry* reg) {
     int choice;
     do {
         // Print main menu
@@ -1098,42 +6996,129 @@ void mainMenu() {
         printf("5. Sort Owners by Name\n");
         printf("6. Print Owners in a direction X times\n");
         printf("7. Exit\n");
+        printf("8. Registry Statistics\n");
+        printf("9. Validate All Pokedexes\n");
+        printf("10. Merge Many Pokedexes\n");
+        printf("11. Query Pokedexes\n");
+        printf("12. Export Registry Columns\n");
+        printf("13. Type Statistics\n");
+        printf("14. Compare Pokedexes\n");
+        printf("15. Trade Pokemon\n");
         // Get input
         choice = readIntSafe("Your choice: ");
+        profileOperation(choice >= 1 && choice <= 15 ? mainMenuOps[choice] : mainMenuOps[0]);
 
         // Pass to correct function based on input
         switch (choice) {
         case 1:
-            openPokedexMenu();
+            openPokedexMenu(reg);
             break;
         case 2:
-            enterExistingPokedexMenu();
+            enterExistingPokedexMenu(reg);
             break;
         case 3:
-            deletePokedex();
+            deletePokedex(reg);
             break;
         case 4:
-            mergePokedexMenu();
+            mergePokedexMenu(reg);
             break;
         case 5:
-            sortOwners();
+            sortOwners(reg);
             break;
         case 6:
-            printOwnersCircular();
+            printOwnersCircular(reg);
             break;
         case 7:
             printf("Goodbye!\n");
             break;
+        case 8:
+            printRegistryStats(reg);
+            break;
+        case 9:
+            validateAllPokedexes(reg);
+            break;
+        case 10:
+            mergeManyMenu(reg);
+            break;
+        case 11:
+            queryMenu(reg);
+            break;
+        case 12:
+            exportColumnsMenu(reg);
+            break;
+        case 13:
+            typeStatisticsMenu(reg);
+            break;
+        case 14:
+            compareMenu(reg);
+            break;
+        case 15:
+            tradeMenu(reg);
+            break;
         default:
             printf("Invalid.\n");
         }
     } while (choice != 7);
 }
 
-int main() {
-    // Get to main menu
-    mainMenu();
-    // Free all owners on exit
-    freeAllOwners();
-    return 0;
+int main(int argc, char* argv[]) {
+    // Optional species catalog replaces the built in one
+    Catalog catalog = {NULL, 0, NULL, NULL};
+    if(argc >= 3 && strcmp(argv[1], "--catalog") == 0) {
+        if(!loadCatalog(argv[2], &catalog)) {
+            return 1;
+        }
+        argc -= 2;
+        argv += 2;
+    }
+    useCatalog(catalog.count ? &catalog : NULL);
+
+    // Load generator only talks to a running server
+    if(argc >= 3 && strcmp(argv[1], "--load") == 0) {
+        int clients = argc > 3 ? atoi(argv[3]) : 8;
+        int requests = argc > 4 ? atoi(argv[4]) : 10000;
+        int result = runLoadGenerator(argv[2], clients, requests);
+        closeCatalog();
+        freeCatalog(&catalog);
+#ifdef EX6_ALLOC_PROFILE
+        printAllocReport(stderr);
+#endif
+        return result;
+    }
+
+    Registry registry;
+    initRegistry(&registry);
+
+    int status = 0;
+    if(argc >= 3 && strcmp(argv[1], "--serve") == 0) {
+        // Serve clients on a unix socket
+        status = runServer(&registry, argv[2], argc > 3 ? argv[3] : NULL);
+    } else if(argc >= 3 && (strcmp(argv[1], "--replay") == 0 || strcmp(argv[1], "--replay-gen") == 0)) {
+        // Replay a recorded or generated session, output is discarded
+        ReplayScript script;
+        int ready;
+        if(strcmp(argv[1], "--replay") == 0) {
+            ready = loadReplayScript(argv[2], &script);
+        } else {
+            int adds = argc > 3 ? atoi(argv[3]) : 40;
+            ready = generateReplayScript(&script, atoi(argv[2]), adds, 12345u);
+            if(ready && argc > 4) {
+                ready = saveReplayScript(&script, argv[4]);
+            }
+        }
+        status = ready ? runReplayScript(&registry, &script, stderr) : 1;
+        freeReplayScript(&script);
+    } else {
+        // Get to main menu
+        mainMenu(&registry);
+    }
+    // Free all owners on exit, catalog names go last
+    destroyRegistry(&registry);
+    closeCatalog();
+    freeCatalog(&catalog);
+    freeInputScratch();
+#ifdef EX6_ALLOC_PROFILE
+    printAllocReport(stderr);
+#endif
+    return status;
 }
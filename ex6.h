@@ -1,10 +1,15 @@
 #ifndef EX6_H
 #define EX6_H
 
+// POSIX threads and sysconf are needed under -std=c99
+#define _POSIX_C_SOURCE 200809L
+
 #include <ctype.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 
 typedef enum {
@@ -25,6 +30,9 @@ typedef enum {
    ICE
 } PokemonType;
 
+// Number of values in PokemonType (for per-type tables)
+#define TYPE_COUNT (ICE + 1)
+
 typedef enum {
    CANNOT_EVOLVE,
    CAN_EVOLVE
@@ -52,12 +60,76 @@ typedef struct PokemonNode {
    struct PokemonNode* right;
 } PokemonNode;
 
+// Immutable, shared node of a persistent (path-copying) Pokédex version
+typedef struct PersistentNode {
+   PokemonData data;                // Own copy, never changed after creation
+   struct PersistentNode* left;
+   struct PersistentNode* right;
+   int refs;                        // Parents and snapshot holders, atomic
+   int maxAttack;                   // Largest attack in this subtree
+   int size;                        // Nodes in this subtree
+} PersistentNode;
+
+// Species catalog indexed by ID - 1
+typedef struct Catalog {
+   const PokemonData* species;  // species[id - 1] for IDs 1..count
+   int count;
+   PokemonData* entries;        // Loaded entries, NULL for the built in table
+   char* names;                 // Interned name storage, NULL for built in
+} Catalog;
+
+// Minimal perfect hash from species name (any case) to species ID
+typedef struct NameIndex {
+   unsigned long long salt;     // Mixed into every name hash
+   int* seeds;                  // Per bucket: >= 0 hash seed, < 0 direct slot
+   int* ids;                    // Slot -> species ID, one slot per name
+   int buckets;
+   int size;                    // Distinct names
+} NameIndex;
+
+// One Pokémon in a node pool: the ID and 32-bit links, the rest is in the catalog
+typedef struct CompactNode {
+   unsigned int id;
+   unsigned int child[2];    // Pool index of left and right, 0 if absent
+} CompactNode;
+
+// Frozen read-optimized Pokédex: a CompactNode pool in Eytzinger (BFS) order
+typedef struct FrozenPokedex {
+   int count;
+   CompactNode* pool;        // pool[1..count], root at 1, pool[0] unused
+   int refs;                 // Owner and readers, atomic
+} FrozenPokedex;
+
+// Counter candidates of one Pokédex grouped by type, kept in step by
+// single writes and dropped by bulk ones
+typedef struct CounterIndex {
+   PokemonData* data;        // Each type's group starts with its best fight score
+   int start[TYPE_COUNT + 1];// Type t is data[start[t]] up to data[start[t + 1]]
+   int capacity;
+   int refs;                 // Owner and readers, atomic
+} CounterIndex;
+
+// Running sums of one Pokédex, adjusted by every write
+typedef struct PokedexTotals {
+   int count;
+   long long hpSum;
+   long long attackSum;
+   int typeCount[TYPE_COUNT];
+} PokedexTotals;
+
 // Linked List Node (for Owners)
 typedef struct OwnerNode {
-   char* ownerName;          // Owner's name
    PokemonNode* pokedexRoot; // Pointer to the root of the owner's Pokédex
    struct OwnerNode* next;   // Next owner in the linked list
    struct OwnerNode* prev;   // Previous owner in the linked list
+   pthread_mutex_t lock;     // Guards this owner's Pokédex
+   PersistentNode* snapshot; // Latest immutable version for lock-free readers
+   FrozenPokedex* frozen;    // Read-optimized copy, dropped on the first write
+   CounterIndex* counters;   // Best counter candidates, built on first use
+   unsigned long serial;     // Creation order, used to order lock acquisition
+   int rebalanceDepth;       // Auto rebalance past this depth, 0 is off
+   PokedexTotals totals;     // Count, sums and types of the Pokédex
+   char ownerName[];         // Owner's name, stored inline after the record
 } OwnerNode;
 
 typedef struct QueueNode {
@@ -70,8 +142,32 @@ typedef struct Queue {
    QueueNode* rear;
 } Queue;
 
-// Global head pointer for the linked list of owners
-OwnerNode* ownerHead = NULL;
+// Registry of all owners, passed around instead of a global head pointer.
+// Lock order: registry lock first, then owner locks by ascending serial.
+typedef struct Registry {
+   OwnerNode* head;                // Head of the circular owners list
+   pthread_rwlock_t lock;          // Read: use owners, Write: change the ring
+   unsigned long nextSerial;       // Serial for the next created owner
+   struct ThreadPool* pool;        // Workers for registry-wide jobs
+} Registry;
+
+// Result of a non-interactive Pokedex operation
+typedef enum {
+   OP_OK,
+   OP_NOT_FOUND,
+   OP_DUPLICATE,
+   OP_EMPTY,
+   OP_CANNOT_EVOLVE,
+   OP_INVALID
+} OpStatus;
+
+typedef struct FightResult {
+   PokemonData first;
+   PokemonData second;
+   float score1;
+   float score2;
+   int winner;                     // 1, 2, or 0 for a tie
+} FightResult;
 
 /* ------------------------------------------------------------
    1) Safe Input + Utility
@@ -101,12 +197,28 @@ char* myStrdup(const char* src);
 int readIntSafe(const char* prompt);
 
 /**
- * @brief Read a line from stdin, store in malloc'd buffer, trim whitespace.
- * @return pointer to the newly allocated string (caller frees)
- * Why we made it: We need flexible name input that handles CR/LF etc.
+ * @brief Read a species ID or species name safely, re-prompt on an unknown name.
+ * @param prompt text to display
+ * @return the ID typed, the ID of the species named, or 0 after printing
+ *         "Invalid ID." for a number outside 1..INT_MAX
+ * Why we made it: Operators know Pokemon by name, not by number.
+ */
+int readSpeciesIdSafe(const char* prompt);
+
+/**
+ * @brief Read a line from stdin into a reusable scratch buffer, trim whitespace.
+ * @return pointer into the scratch buffer, valid until the next call (do not free)
+ * Why we made it: We need flexible name input that handles CR/LF etc.,
+ * without a fresh heap block for every line typed.
  */
 char* getDynamicInput(void);
 
+/**
+ * @brief Free the scratch buffer behind getDynamicInput.
+ * Why we made it: Leaves nothing behind on exit.
+ */
+void freeInputScratch(void);
+
 /**
  * @brief Return a string for a given PokemonType enum.
  * @param type the enum
@@ -129,12 +241,14 @@ PokemonNode* createPokemonNode(PokemonData* data);
 
 /**
  * @brief Create an OwnerNode for the circular owners list.
- * @param ownerName the dynamically allocated name
+ * Caller holds the registry write lock.
+ * @param reg pointer to the Registry
+ * @param ownerName the name, copied inline into the same allocation
  * @param starter BST root for the starter Pokemon
  * @return newly allocated OwnerNode*
  * Why we made it: Each user is represented as an OwnerNode.
  */
-OwnerNode* createOwner(char* ownerName, PokemonNode* starter);
+OwnerNode* createOwner(Registry* reg, const char* ownerName, PokemonNode* starter);
 
 /**
  * @brief Free one PokemonNode (including name).
@@ -145,10 +259,19 @@ void freePokemonNode(PokemonNode* node);
 
 /**
  * @brief Free an OwnerNode (including name and entire Pokedex BST).
+ * Caller holds the registry write lock.
+ * @param reg pointer to the Registry
  * @param owner pointer to the owner
  * Why we made it: Deleting an owner also frees their Pokedex & name.
  */
-void freeOwnerNode(OwnerNode* owner);
+void freeOwnerNode(Registry* reg, OwnerNode* owner);
+
+/**
+ * @brief Free an owner that is already out of the ring.
+ * @param owner pointer to the owner
+ * Why we made it: Shared by freeOwnerNode and the parallel teardown.
+ */
+void destroyOwner(OwnerNode* owner);
 
 /* ------------------------------------------------------------
    3) BST Insert, Search, Remove
@@ -181,6 +304,54 @@ PokemonNode* searchPokemonBFS(PokemonNode* root, int id);
  */
 void removeNodeBST(PokemonNode* root, PokemonNode* parent, OwnerNode* owner, int id);
 
+/**
+ * @brief Unlink node by ID from the BST like removeNodeBST, but keep it alive.
+ * @param root BST root
+ * @param parent parent of root (root itself at the top)
+ * @param owner owner whose pokedexRoot may change
+ * @param id ID to unlink
+ * @return the unlinked node with cleared children, or NULL
+ * Why we made it: Re-keying and moving a node should not reallocate it.
+ */
+PokemonNode* detachNodeBST(PokemonNode* root, PokemonNode* parent, OwnerNode* owner, int id);
+
+/**
+ * @brief Search for a Pokemon by ID along the BST path.
+ * @param root BST root (may be NULL)
+ * @param id ID to find
+ * @return pointer to found node or NULL
+ * Why we made it: O(height) lookup once the BST invariant is kept.
+ */
+PokemonNode* searchPokemonBST(PokemonNode* root, int id);
+
+/**
+ * @brief Link nodes sorted by ID into a balanced BST.
+ * @param nodes array of nodes sorted by ID
+ * @param count number of nodes
+ * @return root of the rebuilt tree
+ * Why we made it: Bulk changes rebuild the tree once in O(n).
+ */
+PokemonNode* buildBalancedTree(PokemonNode** nodes, int count);
+
+/**
+ * @brief Split a BST into IDs below a bound and IDs at or above it.
+ * @param root BST root (consumed)
+ * @param id split bound
+ * @param less out: tree of IDs < id
+ * @param rest out: tree of IDs >= id
+ * Why we made it: Cuts a whole ID span out in O(height).
+ */
+void splitTreeById(PokemonNode* root, int id, PokemonNode** less, PokemonNode** rest);
+
+/**
+ * @brief Join two BSTs where every ID of left is below every ID of right.
+ * @param left lower tree (may be NULL)
+ * @param right higher tree (may be NULL)
+ * @return joined root, right hangs off the maximum of left
+ * Why we made it: Glue the pieces back after a range is cut out.
+ */
+PokemonNode* joinTrees(PokemonNode* left, PokemonNode* right);
+
 /* ------------------------------------------------------------
    4) Generic BST Traversals (Function Pointers)
    ------------------------------------------------------------ */
@@ -229,6 +400,13 @@ void postOrderGeneric(PokemonNode* root, VisitNodeFunc visit);
  */
 void printPokemonNode(PokemonNode* node);
 
+/**
+ * @brief Print one Pokemon's data in the printPokemonNode format.
+ * @param data pointer to the data
+ * Why we made it: Snapshot readers have data but no PokemonNode.
+ */
+void printPokemonData(const PokemonData* data);
+
 /* ------------------------------------------------------------
    5) Display Methods (BFS, Pre, In, Post, Alphabetical)
    ------------------------------------------------------------ */
@@ -339,6 +517,13 @@ void pokemonFight(OwnerNode* owner);
  */
 void evolvePokemon(OwnerNode* owner);
 
+/**
+ * @brief Prompt for one step or final form, then evolve every eligible Pokemon.
+ * @param owner pointer to the Owner
+ * Why we made it: One command instead of an evolve per Pokemon.
+ */
+void evolveAllPokemon(OwnerNode* owner);
+
 /**
  * @brief Prompt for an ID, BFS-check duplicates, then insert into BST.
  * @param owner pointer to the Owner
@@ -353,26 +538,160 @@ void addPokemon(OwnerNode* owner);
  */
 void freePokemon(OwnerNode* owner);
 
+/**
+ * @brief Insert Pokemon by ID into the owner's Pokedex under the owner lock.
+ * @param owner pointer to the Owner
+ * @param id Pokemon ID
+ * @return OP_OK or OP_DUPLICATE
+ * Why we made it: The menu and any worker thread share one safe code path.
+ */
+OpStatus ownerAddPokemon(OwnerNode* owner, int id);
+
+/**
+ * @brief Remove Pokemon by ID from the owner's Pokedex under the owner lock.
+ * @param owner pointer to the Owner
+ * @param id Pokemon ID
+ * @return OP_OK, OP_EMPTY or OP_NOT_FOUND
+ * Why we made it: Thread-safe core of freePokemon.
+ */
+OpStatus ownerReleasePokemon(OwnerNode* owner, int id);
+
+/**
+ * @brief Release every Pokemon with low <= ID <= high under the owner lock.
+ * @param owner pointer to the Owner
+ * @param low lowest ID
+ * @param high highest ID
+ * @param released out: number of Pokemon released
+ * @return OP_OK, OP_EMPTY, OP_NOT_FOUND (nothing in range) or OP_INVALID (low > high)
+ * Why we made it: One split and one join instead of a search per Pokemon.
+ */
+OpStatus ownerReleaseRange(OwnerNode* owner, int low, int high, int* released);
+
+/**
+ * @brief Prompt for an ID range and print the Pokemon in it by ID.
+ * @param owner pointer to the Owner
+ * Why we made it: Look at one evolution family or generation at a time.
+ */
+void displayRangeMenu(OwnerNode* owner);
+
+/**
+ * @brief Prompt for a starting position and page size and print that page.
+ * @param owner pointer to the Owner
+ * Why we made it: Browse a big dex a page at a time.
+ */
+void displayPageMenu(OwnerNode* owner);
+
+/**
+ * @brief Print the Pokemon at a position in ID order, or the position of a Pokemon.
+ * @param owner pointer to the Owner
+ * Why we made it: Menu entry for select and rank.
+ */
+void rankMenu(OwnerNode* owner);
+
+/**
+ * @brief Prompt for an ID range and release every Pokemon in it.
+ * @param owner pointer to the Owner
+ * Why we made it: Drop a whole block of IDs in one go.
+ */
+void releaseRangeMenu(OwnerNode* owner);
+
+/**
+ * @brief Evolve Pokemon by ID under the owner lock, moving it to its new key.
+ * If the evolved ID is already in the Pokedex the old Pokemon is released.
+ * @param owner pointer to the Owner
+ * @param id Pokemon ID
+ * @param before out: data before evolving (may be NULL)
+ * @param after out: data of the evolved form (may be NULL)
+ * @return OP_OK, OP_DUPLICATE (old one released), OP_EMPTY, OP_NOT_FOUND or OP_CANNOT_EVOLVE
+ * Why we made it: Thread-safe core of evolvePokemon.
+ */
+OpStatus ownerEvolvePokemon(OwnerNode* owner, int id, PokemonData* before, PokemonData* after);
+
+/**
+ * @brief Evolve every CAN_EVOLVE Pokemon in one pass, then rebuild the tree once.
+ * @param owner pointer to the Owner
+ * @param toFinal 1 to keep evolving up to the final form, 0 for one step
+ * @param evolved out: number of Pokemon that evolved
+ * @param released out: duplicates freed after evolving
+ * @return OP_OK or OP_EMPTY
+ * Why we made it: Bulk evolve without a search and rewire per Pokemon.
+ */
+OpStatus ownerEvolveAll(OwnerNode* owner, int toFinal, int* evolved, int* released);
+
+/**
+ * @brief Score two Pokemon of the owner under the owner lock.
+ * @param owner pointer to the Owner
+ * @param id1 first Pokemon ID
+ * @param id2 second Pokemon ID
+ * @param result out: both Pokemon, their scores and the winner
+ * @return OP_OK, OP_EMPTY or OP_NOT_FOUND
+ * Why we made it: Thread-safe core of pokemonFight.
+ */
+OpStatus ownerFight(OwnerNode* owner, int id1, int id2, FightResult* result);
+
+/**
+ * @brief Read an owner's running totals and largest attack under the owner lock.
+ * @param owner pointer to the Owner
+ * @param totals out: count, HP and attack sums, per-type counts
+ * @param maxAttack out: largest attack, 0 for an empty Pokedex
+ * Why we made it: O(1) answers that used to need a full traversal.
+ */
+void ownerPokedexSummary(OwnerNode* owner, PokedexTotals* totals, int* maxAttack);
+
+/**
+ * @brief Lock two owners in serial order so concurrent pairs never deadlock.
+ * @param a first owner
+ * @param b second owner (may equal a)
+ * Why we made it: Merges touch two Pokedexes at once.
+ */
+void lockOwnerPair(OwnerNode* a, OwnerNode* b);
+
+/**
+ * @brief Unlock two owners locked by lockOwnerPair.
+ * @param a first owner
+ * @param b second owner (may equal a)
+ * Why we made it: Counterpart of lockOwnerPair.
+ */
+void unlockOwnerPair(OwnerNode* a, OwnerNode* b);
+
 /* ------------------------------------------------------------
    7) Display Menu for a Pokedex
    ------------------------------------------------------------ */
 
 /**
  * @brief Show sub-menu to let user pick BFS, Pre, In, Post, or alphabetical.
+ * Holds the owner lock while printing.
  * @param owner pointer to Owner
  * Why we made it: We want a simple menu that picks from various traversals.
  */
 void displayMenu(OwnerNode* owner);
 
+/**
+ * @brief Print an owner's size, HP and attack totals and averages, largest
+ * attack and type breakdown.
+ * @param owner pointer to Owner
+ * Why we made it: Stats entry of the display menu, instant for any dex size.
+ */
+void printPokedexSummary(OwnerNode* owner);
+
 /* ------------------------------------------------------------
    8) Sorting Owners (Bubble Sort on Circular List)
    ------------------------------------------------------------ */
 
 /**
  * @brief Sort the circular owners list by name.
+ * @param reg pointer to the Registry
  * Why we made it: Another demonstration of pointer manipulation + sorting logic.
  */
-void sortOwners(void);
+void sortOwners(Registry* reg);
+
+/**
+ * @brief Relink the circular owners list in name order.
+ * @param reg pointer to the Registry
+ * @return OP_OK, or OP_INVALID with fewer than 2 owners
+ * Why we made it: Non-interactive core of sortOwners.
+ */
+OpStatus registrySortOwners(Registry* reg);
 
 /* ------------------------------------------------------------
    9) Circular List Linking & Searching
@@ -380,40 +699,49 @@ void sortOwners(void);
 
 /**
  * @brief Insert a new owner into the circular list. If none exist, it's alone.
+ * Caller holds the registry write lock.
+ * @param reg pointer to the Registry
  * @param newOwner pointer to newly created OwnerNode
  * Why we made it: We need a standard approach to keep the list circular.
  */
-void linkOwnerInCircularList(OwnerNode* newOwner);
+void linkOwnerInCircularList(Registry* reg, OwnerNode* newOwner);
 
 /**
  * @brief Remove a specific OwnerNode from the circular list, possibly updating head.
+ * Caller holds the registry write lock.
+ * @param reg pointer to the Registry
  * @param owner pointer to the OwnerNode
  * Why we made it: Deleting or merging owners requires removing them from the ring.
  */
-void removeOwnerFromCircularList(OwnerNode* owner);
+void removeOwnerFromCircularList(Registry* reg, OwnerNode* owner);
 
 /**
  * @brief Find an owner by name in the circular list.
+ * Caller holds the registry lock (read or write).
+ * @param reg pointer to the Registry
  * @param name string to match
  * @return pointer to the matching OwnerNode or NULL
  * Why we made it: We often need to locate an owner quickly.
  */
-OwnerNode* findOwnerByName(const char* name);
+OwnerNode* findOwnerByName(Registry* reg, const char* name);
 
 /**
  * @brief Find an owner by index in the circular list.
+ * Caller holds the registry lock (read or write).
+ * @param reg pointer to the Registry
  * @param index string to match
  * @return pointer to the matching OwnerNode or NULL
  * Why we made it: We often need to locate an owner by index.
  */
-OwnerNode* findOwnerByIndex(const int index);
+OwnerNode* findOwnerByIndex(Registry* reg, const int index);
 
 /**
  * @brief Find the min name owner in the circular list.
+ * @param reg pointer to the Registry
  * @return pointer to the matching OwnerNode or NULL
  * Why we made it: To find the min name owner for sorting.
  */
-OwnerNode* findMinOwnerName();
+OwnerNode* findMinOwnerName(Registry* reg);
 
 /* ------------------------------------------------------------
    10) Owner Menus
@@ -421,27 +749,96 @@ OwnerNode* findMinOwnerName();
 
 /**
  * @brief Let user pick an existing Pokedex (owner) by number, then sub-menu.
+ * Holds the registry read lock for the session so the owner can't vanish.
+ * @param reg pointer to the Registry
  * Why we made it: This is the main interface for adding/fighting/evolving, etc.
  */
-void enterExistingPokedexMenu(void);
+void enterExistingPokedexMenu(Registry* reg);
 
 /**
  * @brief Creates a new Pokedex (prompt for name, check uniqueness, choose starter).
+ * @param reg pointer to the Registry
  * Why we made it: The main entry for building a brand-new Pokedex.
  */
-void openPokedexMenu(void);
+void openPokedexMenu(Registry* reg);
 
 /**
  * @brief Delete an entire Pokedex (owner) from the list.
+ * @param reg pointer to the Registry
  * Why we made it: Let user pick which Pokedex to remove and free everything.
  */
-void deletePokedex(void);
+void deletePokedex(Registry* reg);
 
 /**
  * @brief Merge the second owner's Pokedex into the first, then remove the second owner.
+ * @param reg pointer to the Registry
  * Why we made it: BFS copy demonstration plus removing an owner.
  */
-void mergePokedexMenu(void);
+void mergePokedexMenu(Registry* reg);
+
+/**
+ * @brief Create an owner with starter 1-3 (Bulbasaur, Charmander, Squirtle).
+ * @param reg pointer to the Registry
+ * @param name owner name (copied)
+ * @param starter starter choice
+ * @return OP_OK, OP_DUPLICATE or OP_INVALID
+ * Why we made it: Non-interactive core of openPokedexMenu.
+ */
+OpStatus registryOpenOwner(Registry* reg, const char* name, int starter);
+
+/**
+ * @brief Merge the second owner's Pokedex into the first and remove the second.
+ * @param reg pointer to the Registry
+ * @param name1 owner that keeps the merged Pokedex
+ * @param name2 owner that is removed
+ * @return OP_OK or OP_NOT_FOUND
+ * Why we made it: Non-interactive core of mergePokedexMenu.
+ */
+OpStatus registryMergeOwners(Registry* reg, const char* name1, const char* name2);
+
+/**
+ * @brief Merge many owners into one target and remove them, in one operation.
+ * All Pokedexes are streamed in ID order through a k-way min-heap, the
+ * union is built into the target's tree once, and the sources are unlinked
+ * from the ring in one pass. The target's copy wins on duplicate IDs.
+ * @param reg pointer to the Registry
+ * @param target owner that keeps the merged Pokedex
+ * @param sources owners that are merged in and removed
+ * @param count number of sources
+ * @param released out: duplicate Pokemon freed
+ * @return OP_OK, OP_NOT_FOUND (unknown name) or OP_INVALID (repeated name)
+ * Why we made it: N-1 pairwise merges re-flatten the growing target each time.
+ */
+OpStatus registryMergeMany(Registry* reg, const char* target, const char** sources, int count, int* released);
+
+/**
+ * @brief Prompt for a target and any number of owners, then merge them all.
+ * @param reg pointer to the Registry
+ * Why we made it: Consolidate a whole guild in one step.
+ */
+void mergeManyMenu(Registry* reg);
+
+/**
+ * @brief Move one Pokemon between owners by relinking its node: detached
+ * from the giver and linked into the receiver, O(height) each, with no node
+ * or data allocated or copied. Holds the registry read lock and both owner
+ * locks, so no reader sees it in both or neither.
+ * @param reg pointer to the Registry
+ * @param from giver's name
+ * @param to receiver's name
+ * @param id Pokemon ID
+ * @return OP_OK, OP_NOT_FOUND (owner or Pokemon missing), OP_DUPLICATE
+ * (receiver already has it) or OP_INVALID (same owner)
+ * Why we made it: A trade used to be a release plus a fresh add.
+ */
+OpStatus registryTradePokemon(Registry* reg, const char* from, const char* to, int id);
+
+/**
+ * @brief Prompt for giver, receiver and Pokemon, then trade it.
+ * @param reg pointer to the Registry
+ * Why we made it: Menu entry for trades.
+ */
+void tradeMenu(Registry* reg);
 
 /* ------------------------------------------------------------
    11) Printing Owners in a Circle
@@ -449,35 +846,1320 @@ void mergePokedexMenu(void);
 
 /**
  * @brief Print owners left or right from head, repeating as many times as user wants.
+ * @param reg pointer to the Registry
  * Why we made it: Demonstrates stepping through a circular list in a chosen direction.
  */
-void printOwnersCircular(void);
+void printOwnersCircular(Registry* reg);
+
+#define CIRCULAR_CHUNK 65536
+
+// Receives finished output bytes, ctx is passed through unchanged
+typedef void (*WriteChunkFunc)(void* ctx, const char* data, size_t len);
+
+/**
+ * @brief Stream "[i] name" lines around the ring, prints lines in total.
+ * One cycle of names is rendered once; every line after that is the
+ * counter plus a copy from that cycle, batched into CIRCULAR_CHUNK bytes.
+ * @param reg pointer to the Registry
+ * @param forward 1 to follow next, 0 to follow prev
+ * @param prints number of lines
+ * @param write sink for each filled chunk
+ * @param ctx passed to write
+ * Why we made it: Huge print counts run at copy speed in constant memory.
+ */
+void streamOwnersCircular(Registry* reg, int forward, int prints, WriteChunkFunc write, void* ctx);
 
 /**
  * @brief Print all owners from head.
+ * Caller holds the registry lock (read or write).
+ * @param reg pointer to the Registry
  * Why we made it: Show all the owners in the list.
  */
-void printAllOwners(void);
+void printAllOwners(Registry* reg);
 
 /* ------------------------------------------------------------
    12) Cleanup All Owners at Program End
    ------------------------------------------------------------ */
 
 /**
- * @brief Frees every remaining owner in the circular list, setting ownerHead = NULL.
+ * @brief Frees every remaining owner in the circular list, setting the head to NULL.
+ * The ring is detached first, then owners are torn down on the thread pool.
+ * @param reg pointer to the Registry
  * Why we made it: Ensures a squeaky-clean exit with no leftover memory.
  */
-void freeAllOwners(void);
+void freeAllOwners(Registry* reg);
+
+/**
+ * @brief Set up an empty registry with its lock and thread pool.
+ * @param reg pointer to the Registry
+ * Why we made it: All state lives in a context object, not in globals.
+ */
+void initRegistry(Registry* reg);
+
+/**
+ * @brief Free all owners, the thread pool and the lock of a registry.
+ * @param reg pointer to the Registry
+ * Why we made it: Counterpart of initRegistry.
+ */
+void destroyRegistry(Registry* reg);
+
+/* ------------------------------------------------------------
+   13) Parallel Registry Analytics (Thread Pool)
+   ------------------------------------------------------------ */
+
+/**
+ * @brief Work applied to owners[begin..end) by one pool chunk.
+ * ctx is shared by all chunks, result points to this chunk's own slot.
+ */
+typedef void (*OwnerChunkTask)(OwnerNode** owners, int begin, int end, void* ctx, void* result);
+
+typedef struct ThreadPool {
+   pthread_t* threads;
+   int threadCount;
+   pthread_mutex_t lock;
+   pthread_cond_t workReady;   // Signalled when a new job is posted
+   pthread_cond_t workDone;    // Signalled when the last chunk of a job ends
+   unsigned long generation;   // Bumped for every new job
+   int shutdown;
+   int busy;                   // A job is currently running
+
+   // Current job
+   OwnerChunkTask task;
+   OwnerNode** owners;
+   int ownerCount;
+   void* ctx;
+   char* results;
+   size_t resultSize;
+   int chunkSize;
+   int chunkCount;
+   int nextChunk;
+   int pendingChunks;
+} ThreadPool;
+
+typedef struct RegistryStats {
+   int owners;
+   long pokemon;
+   int largestDex;
+   long totalHp;
+   long totalAttack;
+   double totalStrength;       // Sum of 1.5 x Attack + 1.2 x HP
+   long typeCount[TYPE_COUNT];
+} RegistryStats;
+
+typedef struct InvariantResult {
+   int checked;
+   int broken;
+} InvariantResult;
+
+/**
+ * @brief Start a pool with the given number of worker threads.
+ * @param threads worker count (the calling thread works too, so 0 is valid)
+ * @return newly allocated ThreadPool*
+ * Why we made it: Registry-wide work should use every core, not one.
+ */
+ThreadPool* createThreadPool(int threads);
+
+/**
+ * @brief Stop and join all workers, then free the pool.
+ * @param pool pointer to the pool
+ * Why we made it: No threads may outlive the program's cleanup.
+ */
+void destroyThreadPool(ThreadPool* pool);
+
+/**
+ * @brief Worker count for a pool sized to the online CPUs.
+ * @return number of workers (the caller makes the last one)
+ * Why we made it: Registry-wide speedup should follow the core count.
+ */
+int defaultPoolThreads(void);
+
+/**
+ * @brief Worker thread loop: wait for a job, run chunks, repeat.
+ * @param arg pointer to the ThreadPool
+ * Why we made it: pthread entry point for the pool workers.
+ */
+void* poolWorker(void* arg);
+
+/**
+ * @brief Claim and run chunks of the current job until none are left.
+ * @param pool pointer to the pool (lock held on entry and exit)
+ * Why we made it: Workers and the caller share the same chunk loop.
+ */
+void runPoolChunks(ThreadPool* pool);
+
+/**
+ * @brief Fork-join: split owners into chunks and run task on all cores.
+ * @param pool pointer to the pool
+ * @param owners array of owners
+ * @param count number of owners
+ * @param task work to run per chunk
+ * @param ctx shared context passed to every chunk
+ * @param resultSize bytes of the per-chunk result slot
+ * @param chunkCount out: number of chunks (result slots) used
+ * @return calloc'd array of chunkCount result slots (caller frees)
+ * Why we made it: One generic parallel loop for stats, checks and teardown.
+ */
+void* parallelForOwners(ThreadPool* pool, OwnerNode** owners, int count, OwnerChunkTask task,
+                        void* ctx, size_t resultSize, int* chunkCount);
+
+/**
+ * @brief Snapshot the circular owners list into a flat array.
+ * Caller holds the registry lock (read or write).
+ * @param reg pointer to the Registry
+ * @param count out: number of owners
+ * @return malloc'd array of owners (caller frees) or NULL if none
+ * Why we made it: Chunks need random access to owners.
+ */
+OwnerNode** collectOwners(Registry* reg, int* count);
+
+/**
+ * @brief Add one Pokedex tree into a stats accumulator.
+ * @param root BST root
+ * @param stats accumulator
+ * @return number of Pokemon in the tree
+ * Why we made it: Per-owner part of the registry aggregates.
+ */
+int accumulateTreeStats(PokemonNode* root, RegistryStats* stats);
+
+/**
+ * @brief Check that a subtree is a strict BST within (low, high).
+ * @param root subtree root
+ * @param low exclusive lower bound
+ * @param high exclusive upper bound
+ * @return 1 if valid, 0 otherwise
+ * Why we made it: Every search relies on the BST ordering holding.
+ */
+int isValidBST(PokemonNode* root, long low, long high);
+
+/**
+ * @brief Chunk tasks for the parallel loop (stats, invariants, teardown).
+ * Stats and invariants take each owner's lock while reading its tree.
+ * Why we made it: Each one works on its own owners and its own result slot.
+ */
+void statsChunkTask(OwnerNode** owners, int begin, int end, void* ctx, void* result);
+void invariantChunkTask(OwnerNode** owners, int begin, int end, void* ctx, void* result);
+void teardownChunkTask(OwnerNode** owners, int begin, int end, void* ctx, void* result);
+
+/**
+ * @brief Compute registry-wide aggregates in parallel.
+ * Caller holds the registry lock (read or write).
+ * @param reg pointer to the Registry
+ * @param stats out: filled with the totals
+ * Why we made it: Type histogram, total strength and dex sizes for all owners.
+ */
+void computeRegistryStats(Registry* reg, RegistryStats* stats);
+
+/**
+ * @brief Print registry-wide aggregates.
+ * @param reg pointer to the Registry
+ * Why we made it: Main menu entry for the parallel stats.
+ */
+void printRegistryStats(Registry* reg);
+
+/**
+ * @brief Validate the BST invariant of every owner's Pokedex in parallel.
+ * @param reg pointer to the Registry
+ * Why we made it: Catch corrupted trees across the whole registry at once.
+ */
+void validateAllPokedexes(Registry* reg);
+
+/* ------------------------------------------------------------
+   14) Socket Server Mode and Load Generator
+   ------------------------------------------------------------ */
+
+// Line protocol, one command per line, tokens split by spaces:
+//   open <owner> <starter 1-3>      add <owner> <id>
+//   release <owner> <id>            evolve <owner> <id>
+//   fight <owner> <id1> <id2>       display <owner> <bfs|pre|in|post|alpha>
+//   evolveall <owner> [final]       merge <owner1> <owner2>
+//   freeze <owner>                  sort
+//   range <owner> <low> <high>      releaserange <owner> <low> <high>
+//   releasewhere <owner> <field> <op> <value>
+//   health <owner>                  rebalance <owner>
+//   autorebalance <owner> <depth, 0 = off>
+//   mergemany <target> <owner> [owner ...]
+//   query from <owner|*> [where ...] [sort ...] [limit n] [show ...]
+//   export <file>                   typestats [file]   (plain names in the file directory)
+//   summary <owner>                 rank <owner> <id>
+//   nth <owner> <position>          page <owner> <first> <count>
+//   compare <owner1> <owner2> <both|only|xor>
+//   trade <from> <to> <id>          counter <owner> <id> [count]
+//   team <owner> [most of one type, 0 = no limit] [type to cover ...]
+//   print <F|B> <count>             quit
+// Any <id> may also be a species name without spaces, in any case.
+// A line takes at most SERVER_MAX_ARGS tokens after the command.
+// Every response ends with a line starting with "OK" or "ERR".
+
+#define SERVER_READ_CHUNK 4096
+#define SERVER_MAX_EVENTS 64
+#define SERVER_MAX_LINE 1024
+#define SERVER_MAX_ARGS 32
+#define SERVER_MAX_PRINTS 100000
+
+typedef struct Connection {
+   int fd;
+   char* in;                 // Bytes read but not yet parsed into lines
+   size_t inLen;
+   size_t inCap;
+   char* out;                // Response bytes not yet written
+   size_t outLen;
+   size_t outSent;
+   size_t outCap;
+   int closing;              // Close once out is flushed
+   struct Connection* next;  // Live connections list, freed on shutdown
+   struct Connection* prev;
+} Connection;
+
+/**
+ * @brief Listen on a Unix domain socket and serve clients until SIGINT/SIGTERM.
+ * @param reg pointer to the Registry
+ * @param path socket path (replaced if it exists)
+ * @param fileDir directory export and typestats files are kept in, NULL refuses them
+ * @return 0 on clean shutdown, 1 on setup failure
+ * Why we made it: Many clients share one registry instead of one stdin session.
+ */
+int runServer(Registry* reg, const char* path, const char* fileDir);
+
+/**
+ * @brief Append formatted text to a connection's output buffer.
+ * @param conn pointer to the connection
+ * @param format printf-style format
+ * Why we made it: Responses are built in memory and flushed by the event loop.
+ */
+void connPrintf(Connection* conn, const char* format, ...);
+
+/**
+ * @brief Parse and run one protocol line, appending the response.
+ * @param reg pointer to the Registry
+ * @param conn pointer to the connection
+ * @param line NUL-terminated command (modified by tokenizing)
+ * Why we made it: Maps protocol commands onto the registry operations.
+ */
+void serverHandleLine(Registry* reg, Connection* conn, char* line);
+
+/**
+ * @brief Print one Pokemon into the current server connection.
+ * @param data pointer to the Pokemon data
+ * Why we made it: printPokemonData counterpart for sockets.
+ */
+void serverPrintData(const PokemonData* data);
+
+/**
+ * @brief Open N client connections, fire a request mix, report throughput and latency.
+ * @param path server socket path
+ * @param clients number of concurrent clients
+ * @param requests requests per client
+ * @return 0 on success, 1 if no client could connect
+ * Why we made it: Measure commands per second and p99 latency of the server.
+ */
+int runLoadGenerator(const char* path, int clients, int requests);
+
+/* ------------------------------------------------------------
+   15) Persistent Pokedex Snapshots
+   ------------------------------------------------------------ */
+
+// Every write publishes a new version root in O(log n) that shares all
+// untouched nodes with the previous one. Readers pin a version with
+// acquirePokedexSnapshot and walk it without holding the owner lock.
+// A version is freed when its last parent or holder releases it.
+// Versions mirror the exact shape of the mutable tree, so every
+// traversal order prints the same as on pokedexRoot.
+
+typedef void (*VisitDataFunc)(const PokemonData*);
+
+/**
+ * @brief Create a persistent node owning one reference to each child.
+ * @param data data to copy in
+ * @param left left child (reference is taken over)
+ * @param right right child (reference is taken over)
+ * @return new node with one reference
+ * Why we made it: Path copying builds new nodes around shared children.
+ */
+PersistentNode* createPersistentNode(const PokemonData* data, PersistentNode* left, PersistentNode* right);
+
+/**
+ * @brief Add a reference to a persistent node.
+ * @param node node or NULL
+ * @return node
+ * Why we made it: Shared subtrees and readers each hold a reference.
+ */
+PersistentNode* retainPersistent(PersistentNode* node);
+
+/**
+ * @brief Drop a reference, freeing the node and releasing its children at zero.
+ * @param node node or NULL
+ * Why we made it: Old versions disappear once nobody uses them.
+ */
+void releasePersistent(PersistentNode* node);
+
+/**
+ * @brief New version with data inserted like insertPokemonNode.
+ * @param root current version (not consumed)
+ * @param data data to insert
+ * @return new version root (one reference)
+ * Why we made it: O(log n) persistent insert.
+ */
+PersistentNode* persistentInsert(PersistentNode* root, const PokemonData* data);
+
+/**
+ * @brief New version with a shared subtree hung where its root ID belongs.
+ * @param root current version (not consumed)
+ * @param subtree subtree to attach (not consumed)
+ * @return new version root (one reference)
+ * Why we made it: Mirrors removeNodeBST re-inserting a left subtree.
+ */
+PersistentNode* persistentAttach(PersistentNode* root, PersistentNode* subtree);
+
+/**
+ * @brief New version without id, removed like removeNodeBST.
+ * @param root current version (not consumed)
+ * @param id ID to remove
+ * @return new version root (one reference, may be NULL)
+ * Why we made it: O(log n) persistent remove keeping the mutable tree shape.
+ */
+PersistentNode* persistentRemove(PersistentNode* root, int id);
+
+/**
+ * @brief New version with the data of id replaced.
+ * @param root current version (not consumed)
+ * @param id ID to replace
+ * @param data replacement data
+ * @return new version root (one reference)
+ * Why we made it: In-place data changes need a new version as well.
+ */
+PersistentNode* persistentReplace(PersistentNode* root, int id, const PokemonData* data);
+
+/**
+ * @brief Build a version with the same shape as a mutable tree.
+ * @param root mutable BST root
+ * @return new version root (one reference)
+ * Why we made it: O(n) resync after bulk changes like merges.
+ */
+PersistentNode* persistentFromTree(PokemonNode* root);
+
+/**
+ * @brief Split a version like splitTreeById, copying only the split path.
+ * @param root current version (not consumed)
+ * @param id split bound
+ * @param less out: version of IDs < id (one reference)
+ * @param rest out: version of IDs >= id (one reference)
+ * Why we made it: Keeps snapshots in the mutable tree's shape after a range release.
+ */
+void persistentSplit(PersistentNode* root, int id, PersistentNode** less, PersistentNode** rest);
+
+/**
+ * @brief Swap in a new version for the owner. Caller holds the owner lock.
+ * @param owner pointer to the Owner
+ * @param version new version (reference is taken over)
+ * Why we made it: Writers publish, the old version lives on for its readers.
+ */
+void publishSnapshot(OwnerNode* owner, PersistentNode* version);
+
+/**
+ * @brief Pin the owner's current version.
+ * @param owner pointer to the Owner
+ * @return version root (release with releasePersistent)
+ * Why we made it: Readers hold the owner lock only for one pointer copy.
+ */
+PersistentNode* acquirePokedexSnapshot(OwnerNode* owner);
+
+/**
+ * @brief Snapshot traversals, same orders as the PokemonNode ones.
+ * @param root version root
+ * @param visit function called with each Pokemon's data
+ * Why we made it: Display a consistent version while writers go on.
+ */
+void snapshotBFS(PersistentNode* root, VisitDataFunc visit);
+void snapshotPreOrder(PersistentNode* root, VisitDataFunc visit);
+void snapshotInOrder(PersistentNode* root, VisitDataFunc visit);
+void snapshotPostOrder(PersistentNode* root, VisitDataFunc visit);
+void snapshotAlphabetical(PersistentNode* root, VisitDataFunc visit);
+
+/**
+ * @brief Run one of the five display orders (1-5 as in displayMenu) on a version.
+ * @param root version root
+ * @param choice display choice
+ * @param visit function called with each Pokemon's data
+ * @return 1 if choice was valid
+ * Why we made it: Shared by displayMenu and the server.
+ */
+int displaySnapshot(PersistentNode* root, int choice, VisitDataFunc visit);
+
+/**
+ * @brief Visit, in ID order, the Pokemon of a version with low <= ID <= high.
+ * @param root version root
+ * @param low lowest ID
+ * @param high highest ID
+ * @param visit function called with each Pokemon's data
+ * @return number of Pokemon visited
+ * Why we made it: Skips subtrees outside the range, O(height + k).
+ */
+int snapshotRange(PersistentNode* root, int low, int high, VisitDataFunc visit);
+
+/**
+ * @brief Find the k-th smallest ID of a version using subtree sizes.
+ * @param root version root
+ * @param k position in ID order, 1 is the smallest
+ * @return that Pokemon's data, or NULL if k is out of range
+ * Why we made it: O(height) positional lookup without a scan.
+ */
+const PokemonData* snapshotSelect(PersistentNode* root, int k);
+
+/**
+ * @brief Position of an ID in ID order, using subtree sizes.
+ * @param root version root
+ * @param id Pokemon ID
+ * @return 1 for the smallest ID, or 0 if the ID is not in the version
+ * Why we made it: Inverse of snapshotSelect in O(height).
+ */
+int snapshotRank(PersistentNode* root, int id);
+
+/**
+ * @brief Visit count Pokemon in ID order starting at position first.
+ * @param root version root
+ * @param first position of the first Pokemon, 1 is the smallest
+ * @param count page size
+ * @param visit function called with each Pokemon's data
+ * @return number of Pokemon visited
+ * Why we made it: Any page of a huge dex in O(height + count).
+ */
+int snapshotPage(PersistentNode* root, int first, int count, VisitDataFunc visit);
+
+/* ------------------------------------------------------------
+   16) Frozen Eytzinger Pokedex
+   ------------------------------------------------------------ */
+
+// Freezing relinks the BST into the complete tree the Eytzinger pool
+// describes, so the pool's linear order is exactly the tree's BFS order.
+// Every field of PokemonData belongs to the species, so a pool node keeps
+// only the ID and its links: 12 bytes instead of a node plus its data.
+// The BST is kept alongside, which makes thawing on a write O(1).
+
+/**
+ * @brief Build a frozen copy of a BST and relink the BST into the same shape.
+ * @param root BST root
+ * @param newRoot out: root of the relinked BST
+ * @return new FrozenPokedex with one reference
+ * Why we made it: Search and scans over one small contiguous pool.
+ */
+FrozenPokedex* freezeTree(PokemonNode* root, PokemonNode** newRoot);
+
+/**
+ * @brief Branch-free search along the pool links with prefetching.
+ * @param frozen pointer to the frozen Pokedex
+ * @param id ID to find
+ * @return pool index, or 0 if missing
+ * Why we made it: Lookups touch a few cache lines of a dense pool.
+ */
+int frozenSearch(const FrozenPokedex* frozen, int id);
+
+/**
+ * @brief Visit frozen data in BFS order by scanning the pool.
+ * @param frozen pointer to the frozen Pokedex
+ * @param visit function called with each Pokemon's catalog data
+ * Why we made it: Level order of the Eytzinger layout is its pool order.
+ */
+void frozenScanBFS(const FrozenPokedex* frozen, VisitDataFunc visit);
+
+/**
+ * @brief Drop a reference, freeing the pool at zero.
+ * @param frozen pointer or NULL
+ * Why we made it: A reader may still scan after a writer thawed the owner.
+ */
+void releaseFrozen(FrozenPokedex* frozen);
+
+/**
+ * @brief Pin the owner's frozen copy if there is one.
+ * @param owner pointer to the Owner
+ * @return frozen copy (release with releaseFrozen) or NULL
+ * Why we made it: Readers use the array without holding the owner lock.
+ */
+FrozenPokedex* acquireFrozen(OwnerNode* owner);
+
+/**
+ * @brief Freeze the owner's Pokedex under the owner lock.
+ * @param owner pointer to the Owner
+ * @param count out: number of Pokemon frozen
+ * @return OP_OK or OP_EMPTY
+ * Why we made it: Switch a read-mostly Pokedex to the array layout.
+ */
+OpStatus ownerFreezePokedex(OwnerNode* owner, int* count);
+
+/**
+ * @brief Back to mutable-only. Caller holds the owner lock.
+ * @param owner pointer to the Owner
+ * Why we made it: Every write calls it first so the copy never goes stale.
+ */
+void thawPokedex(OwnerNode* owner);
+
+/**
+ * @brief Menu entry to freeze the current owner's Pokedex.
+ * @param owner pointer to the Owner
+ * Why we made it: Let the user mark a Pokedex as read-mostly.
+ */
+void freezePokedexMenu(OwnerNode* owner);
+
+/* ------------------------------------------------------------
+   17) Species Catalog
+   ------------------------------------------------------------ */
+
+// Species are looked up by ID through the active catalog: the built in
+// table below unless a file was loaded with --catalog. IDs are dense from
+// 1, so lookup is one bounds check and one index. Loaded names point into
+// the catalog's interned name storage, so the catalog must outlive every
+// owner that holds its data.
+
+/**
+ * @brief Load a CSV species catalog through mmap.
+ * @param path file with lines "id,name,type,hp,attack,canEvolve"
+ * @param catalog out: filled catalog, owns its memory
+ * @return 1 on success, 0 on error (reason printed to stderr)
+ * Why we made it: Ship bigger catalogs without recompiling the program.
+ */
+int loadCatalog(const char* path, Catalog* catalog);
+
+/**
+ * @brief Free the memory of a loaded catalog.
+ * @param catalog catalog filled by loadCatalog
+ * Why we made it: Pair for loadCatalog.
+ */
+void freeCatalog(Catalog* catalog);
+
+/**
+ * @brief Make a catalog the one every lookup uses and index its names.
+ * @param catalog catalog to use, or NULL for the built in one
+ * Why we made it: Swap catalogs once at startup, before any owner exists.
+ */
+void useCatalog(const Catalog* catalog);
+
+/**
+ * @brief Drop the name index and go back to the built in catalog.
+ * Why we made it: Frees what useCatalog built, on exit.
+ */
+void closeCatalog(void);
+
+/**
+ * @brief Build a minimal perfect hash over the catalog's species names.
+ * @param catalog catalog to index
+ * @param index out: filled index, duplicate names keep the lowest ID
+ * Why we made it: Resolving a name costs one hash and one compare.
+ */
+void buildNameIndex(const Catalog* catalog, NameIndex* index);
+
+/**
+ * @brief Free a name index.
+ * @param index index filled by buildNameIndex
+ * Why we made it: Pair for buildNameIndex.
+ */
+void freeNameIndex(NameIndex* index);
+
+/**
+ * @brief Species ID by name in the active catalog, ignoring case.
+ * @param name species name
+ * @return species ID, or 0 if no species has that name
+ * Why we made it: Name based add, release, fight and evolve.
+ */
+int findSpeciesByName(const char* name);
+
+/**
+ * @brief Bounds checked species lookup in the active catalog.
+ * @param id species ID
+ * @return species data, or NULL if the ID is out of range
+ * Why we made it: Replaces raw pokedex[id-1] indexing with unchecked IDs.
+ */
+const PokemonData* getSpecies(int id);
+
+/**
+ * @brief Number of species in the active catalog.
+ * @return species count
+ * Why we made it: Upper bound for ID validation and per-species tables.
+ */
+int speciesCount(void);
+
+/* ------------------------------------------------------------
+   18) Bulk Release by Filter
+   ------------------------------------------------------------ */
+
+// A filter is "<field> <op> <value>", e.g. "type == BUG", "hp < 50" or
+// "evolve == 0". Fields: id, type, hp, attack, evolve. Ops: < <= == != >= >.
+// Types may be given by name in any case.
+
+typedef int (*PokemonPredicate)(const PokemonData* data, const void* arg);
+
+typedef enum {
+   FILTER_ID,
+   FILTER_TYPE,
+   FILTER_HP,
+   FILTER_ATTACK,
+   FILTER_EVOLVE
+} FilterField;
+
+typedef enum {
+   FILTER_LT,
+   FILTER_LE,
+   FILTER_EQ,
+   FILTER_NE,
+   FILTER_GE,
+   FILTER_GT
+} FilterOp;
+
+typedef struct PokemonFilter {
+   FilterField field;
+   FilterOp op;
+   int value;
+} PokemonFilter;
+
+/**
+ * @brief Parse a filter like "type == BUG".
+ * @param text filter text
+ * @param filter out: parsed filter
+ * @return 1 if the text is a valid filter
+ * Why we made it: Menu and server take the same filter language.
+ */
+int parsePokemonFilter(const char* text, PokemonFilter* filter);
+
+/**
+ * @brief PokemonPredicate that tests a PokemonFilter.
+ * @param data Pokemon to test
+ * @param arg const PokemonFilter*
+ * @return 1 if the Pokemon matches
+ * Why we made it: Ready-made predicate for ownerReleaseWhere.
+ */
+int matchPokemonFilter(const PokemonData* data, const void* arg);
+
+/**
+ * @brief Release every Pokemon matching a predicate under the owner lock,
+ * in one in-order pass, then rebuild the survivors into a balanced tree.
+ * @param owner pointer to the Owner
+ * @param match predicate, called once per Pokemon
+ * @param arg passed through to match
+ * @param released out: number of Pokemon released
+ * @return OP_OK, OP_EMPTY or OP_NOT_FOUND (nothing matched)
+ * Why we made it: O(n) bulk cleanup instead of a search and rewire per Pokemon.
+ */
+OpStatus ownerReleaseWhere(OwnerNode* owner, PokemonPredicate match, const void* arg, int* released);
+
+/**
+ * @brief Prompt for a filter and release every matching Pokemon.
+ * @param owner pointer to the Owner
+ * Why we made it: "Release all BUG types" in one command.
+ */
+void releaseWhereMenu(OwnerNode* owner);
+
+/* ------------------------------------------------------------
+   19) Tree Health and Rebalancing
+   ------------------------------------------------------------ */
+
+// Depths count edges from the root (root depth 0); height counts levels.
+// The imbalance ratio compares the height with the smallest height that
+// many nodes can have, so a perfectly balanced tree scores 1.0.
+
+typedef struct TreeHealth {
+   int count;
+   int height;
+   int maxDepth;
+   double avgDepth;
+   double imbalance;
+} TreeHealth;
+
+/**
+ * @brief Measure shape statistics of a Pokedex version.
+ * @param root version root (snapshots have the same shape as the tree)
+ * @param health out: filled statistics
+ * Why we made it: See trees degrade as releases rewire them.
+ */
+void computeTreeHealth(PersistentNode* root, TreeHealth* health);
+
+/**
+ * @brief Rebuild a BST into balanced shape with Day-Stout-Warren rotations.
+ * @param root BST root
+ * @return new root; O(n) time, O(1) extra space
+ * Why we made it: Rebalance in place without an array of all nodes.
+ */
+PokemonNode* rebalanceTree(PokemonNode* root);
+
+/**
+ * @brief Rebalance the owner's Pokedex under the owner lock.
+ * @param owner pointer to the Owner
+ * @return OP_OK or OP_EMPTY
+ * Why we made it: Thread-safe core of the rebalance command.
+ */
+OpStatus ownerRebalance(OwnerNode* owner);
+
+/**
+ * @brief Depth of a Pokemon in a BST.
+ * @param root BST root
+ * @param id Pokemon ID
+ * @return depth, or -1 if the ID is not in the tree
+ * Why we made it: Cheap O(height) probe after a write.
+ */
+int depthOfPokemon(PokemonNode* root, int id);
+
+/**
+ * @brief Rebalance if a probed depth passed the owner's threshold.
+ * Caller holds the owner lock.
+ * @param owner pointer to the Owner
+ * @param depth depth found along the path a write touched
+ * Why we made it: Automatic rebuild without measuring the whole tree per write.
+ */
+void maybeRebalance(OwnerNode* owner, int depth);
+
+/**
+ * @brief Print tree health of the owner's Pokedex and offer a rebalance.
+ * @param owner pointer to the Owner
+ * Why we made it: Menu entry for diagnostics, rebalance and the threshold.
+ */
+void treeHealthMenu(OwnerNode* owner);
+
+/* ------------------------------------------------------------
+   20) Allocation Profiler (EX6_ALLOC_PROFILE builds)
+   ------------------------------------------------------------ */
+
+// Build with -DEX6_ALLOC_PROFILE to route every malloc, calloc, realloc
+// and free in ex6.c through a counting allocator. Bytes and calls are
+// charged to the operation the calling thread is running (a menu choice
+// or a server command), peak live bytes are tracked, and at exit a report
+// on stderr lists per-operation totals and every block still alive,
+// grouped by the file:line that allocated it. Without the flag
+// profileOperation compiles to nothing. The allocators carry the same
+// size attributes as the libc ones, so GCC still bounds-checks their
+// blocks; realloc-like profRealloc is not marked malloc, as its block
+// keeps the pointers it held.
+
+#ifdef EX6_ALLOC_PROFILE
+
+#define PROFILE_MAX_OPS 64
+#define PROFILE_OP_NAME 24
+
+/**
+ * @brief Counting malloc; the macro in ex6.c passes the call site.
+ * @param size bytes
+ * @param file allocating file
+ * @param line allocating line
+ * @return block like malloc
+ * Why we made it: Every allocation gets a site and an operation.
+ */
+void* profMalloc(size_t size, const char* file, int line) __attribute__((malloc, alloc_size(1)));
+
+/**
+ * @brief Counting calloc.
+ * @param count element count
+ * @param size element size
+ * @param file allocating file
+ * @param line allocating line
+ * @return zeroed block like calloc
+ * Why we made it: Same accounting as profMalloc.
+ */
+void* profCalloc(size_t count, size_t size, const char* file, int line) __attribute__((malloc, alloc_size(1, 2)));
+
+/**
+ * @brief Counting realloc, the block takes the new call site.
+ * @param ptr block from the profiler (or NULL)
+ * @param size new size
+ * @param file allocating file
+ * @param line allocating line
+ * @return moved block like realloc
+ * Why we made it: NodeArray and buffers grow through realloc.
+ */
+void* profRealloc(void* ptr, size_t size, const char* file, int line) __attribute__((alloc_size(2)));
+
+/**
+ * @brief Counting free.
+ * @param ptr block from the profiler (or NULL)
+ * Why we made it: Live bytes and the leak list shrink here.
+ */
+void profFree(void* ptr);
+
+/**
+ * @brief Charge the calling thread's next allocations to an operation.
+ * @param name operation name, copied
+ * Why we made it: Tell which command a regression comes from.
+ */
+void profileOperation(const char* name);
+
+/**
+ * @brief Print per-operation totals, peak usage and live blocks by site.
+ * @param out stream to print to
+ * Why we made it: Leak report at exit without valgrind.
+ */
+void printAllocReport(FILE* out);
+
+#else
+
+#define profileOperation(name) ((void)(name))
+
+#endif
+
+/* ------------------------------------------------------------
+   21) Query Pipeline
+   ------------------------------------------------------------ */
+
+// A query reads Pokemon from one owner or from all of them and pushes each
+// one through a chain of stages, for example
+//   from * where type == FIRE and hp > 40 sort attack desc limit 10 show owner,name,attack
+// Only "from" is required; the other clauses must come in this order.
+// Conditions use the filter language above. Sort and show fields are
+// id, name, type, hp, attack and evolve, plus owner. Owner names with spaces go in
+// double quotes. Without a sort, rows stream out in ID order per owner
+// and a limit stops the walk early. A sort with a limit keeps only the
+// best rows in a bounded heap.
+
+#define QUERY_MAX_FILTERS 8
+#define QUERY_MAX_FIELDS 7
+#define QUERY_CHUNK 4096
+
+typedef enum {
+   QUERY_OWNER,
+   QUERY_ID,
+   QUERY_NAME,
+   QUERY_TYPE,
+   QUERY_HP,
+   QUERY_ATTACK,
+   QUERY_EVOLVE
+} QueryField;
+
+typedef struct PokemonQuery {
+   const char* source;                       // Owner name, NULL for all owners
+   PokemonFilter filters[QUERY_MAX_FILTERS]; // All must match
+   int filterCount;
+   int sorted;
+   QueryField sortField;
+   int descending;
+   int limit;                                // -1 for no limit
+   QueryField fields[QUERY_MAX_FIELDS];
+   int fieldCount;                           // 0 prints the full entry
+} PokemonQuery;
+
+/**
+ * @brief Parse query text. The text is split in place, and the query
+ * points into it.
+ * @param text query text, modified
+ * @param query out: parsed query
+ * @return 1 if the text is a valid query
+ * Why we made it: Menu and server share one query language.
+ */
+int parsePokemonQuery(char* text, PokemonQuery* query);
+
+/**
+ * @brief Run a query over pinned snapshots and write the rows to a sink.
+ * Only a sort holds rows in memory, and with a limit it holds at most
+ * limit rows.
+ * @param reg pointer to the Registry
+ * @param query parsed query
+ * @param write sink for the output text
+ * @param ctx passed through to write
+ * @param rows out: number of rows written
+ * @return OP_OK, or OP_NOT_FOUND if the source owner does not exist
+ * Why we made it: Ad-hoc questions without writing a new menu for each.
+ */
+OpStatus runPokemonQuery(Registry* reg, const PokemonQuery* query, WriteChunkFunc write, void* ctx, int* rows);
+
+/**
+ * @brief Prompt for a query and print its rows.
+ * @param reg pointer to the Registry
+ * Why we made it: Menu access to the query pipeline.
+ */
+void queryMenu(Registry* reg);
+
+/* ------------------------------------------------------------
+   22) Columnar Export and Aggregates
+   ------------------------------------------------------------ */
+
+// The whole registry as a struct of arrays: row i is one Pokemon, and each
+// field sits in its own contiguous column. Rows go owner by owner in ring
+// order and by ID within an owner. File layout, native byte order:
+//   "EX6COLS" plus a NUL, uint32 version, uint32 owners, uint32 rows,
+//   per owner: uint32 name length and the name bytes,
+//   then the columns: owner (uint32), id (int32), type (uint8),
+//   hp (int32), attack (int32), each one rows entries long.
+// Aggregates read each column once: every row adds into its own type's
+// slot and histogram buckets, with no branch on the row's values.
+
+#define COLUMNS_VERSION 1
+#define COLUMN_BINS 10                 // Histogram buckets
+#define COLUMN_BIN_WIDTH 20            // Last bucket takes everything above
+
+typedef struct PokedexColumns {
+   int owners;
+   int rows;
+   char** ownerNames;                  // Point into nameData
+   char* nameData;
+   unsigned int* owner;                // Index into ownerNames
+   int* id;
+   unsigned char* type;
+   int* hp;
+   int* attack;
+} PokedexColumns;
+
+typedef struct TypeAggregate {
+   int count;
+   long long hpSum;
+   long long attackSum;
+   int hpMax;
+   int attackMax;
+} TypeAggregate;
+
+typedef struct ColumnAggregates {
+   TypeAggregate types[TYPE_COUNT];
+   int hpHistogram[COLUMN_BINS];
+   int attackHistogram[COLUMN_BINS];
+} ColumnAggregates;
+
+/**
+ * @brief Copy every owner's Pokedex into columns, reading pinned snapshots.
+ * @param reg pointer to the Registry
+ * @param columns out: filled columns, free with freePokedexColumns
+ * Why we made it: One sequential copy, then every scan is cache friendly.
+ */
+void buildPokedexColumns(Registry* reg, PokedexColumns* columns);
+
+/**
+ * @brief Write columns to a binary file.
+ * @param columns columns to write
+ * @param path file to create or replace
+ * @return 1 on success, 0 after printing the error to stderr
+ * Why we made it: Analytics can run on a copy without the live registry.
+ */
+int exportPokedexColumns(const PokedexColumns* columns, const char* path);
+
+/**
+ * @brief Read columns back from a file written by exportPokedexColumns.
+ * @param path file to read
+ * @param columns out: filled columns, free with freePokedexColumns
+ * @return 1 on success, 0 after printing the error to stderr
+ * Why we made it: Aggregate an export taken earlier.
+ */
+int loadPokedexColumns(const char* path, PokedexColumns* columns);
+
+/**
+ * @brief Free the arrays of a PokedexColumns.
+ * @param columns columns to free
+ * Why we made it: Pair for buildPokedexColumns and loadPokedexColumns.
+ */
+void freePokedexColumns(PokedexColumns* columns);
+
+/**
+ * @brief Group-by-type counts, sums and maxima plus HP and attack histograms.
+ * @param columns columns to scan
+ * @param result out: aggregates
+ * Why we made it: Registry-wide averages without walking any tree.
+ */
+void aggregatePokedexColumns(const PokedexColumns* columns, ColumnAggregates* result);
+
+/**
+ * @brief Write per-type averages and maxima and both histograms as text.
+ * @param result aggregates to print
+ * @param rows number of Pokemon they cover
+ * @param write sink for the text
+ * @param ctx passed through to write
+ * Why we made it: Menu and server print the same report.
+ */
+void writeColumnAggregates(const ColumnAggregates* result, int rows, WriteChunkFunc write, void* ctx);
+
+/**
+ * @brief Prompt for a file and export the registry to it.
+ * @param reg pointer to the Registry
+ * Why we made it: Menu entry for the columnar export.
+ */
+void exportColumnsMenu(Registry* reg);
+
+/**
+ * @brief Print per-type statistics and histograms of the live registry or
+ * of an exported file.
+ * @param reg pointer to the Registry
+ * Why we made it: Menu entry for the aggregates.
+ */
+void typeStatisticsMenu(Registry* reg);
+
+/* ------------------------------------------------------------
+   23) Set Operations Between Pokedexes
+   ------------------------------------------------------------ */
+
+// Set operations compare two Pokedexes by ID and report in ID order. The
+// general case walks both versions in order at once, O(n + m). When the
+// IDs of both are packed into a span at most SET_DENSE_FACTOR times their
+// combined size, membership goes into bitsets instead, and 64 IDs are
+// combined per AND, AND-NOT or XOR.
+
+#define SET_DENSE_FACTOR 4
+
+typedef enum {
+   SET_INTERSECTION,   // In both
+   SET_DIFFERENCE,     // In the first only
+   SET_SYMMETRIC       // In exactly one
+} SetOperation;
+
+/**
+ * @brief Visit, in ID order, the Pokemon a set operation selects.
+ * Shared Pokemon are reported with the first version's data.
+ * @param a first version root
+ * @param b second version root
+ * @param op operation
+ * @param visit function called with each selected Pokemon's data
+ * @return number of Pokemon visited
+ * Why we made it: Linear-time comparison instead of a search per Pokemon.
+ */
+int snapshotSetOperation(PersistentNode* a, PersistentNode* b, SetOperation op, VisitDataFunc visit);
+
+/**
+ * @brief Run a set operation on two named owners' pinned snapshots.
+ * @param reg pointer to the Registry
+ * @param name1 first owner
+ * @param name2 second owner
+ * @param op operation
+ * @param visit function called with each selected Pokemon's data
+ * @param count out: number of Pokemon visited
+ * @return OP_OK, or OP_NOT_FOUND if either owner is missing
+ * Why we made it: Thread-safe core shared by the menu and the server.
+ */
+OpStatus registryCompareOwners(Registry* reg, const char* name1, const char* name2, SetOperation op,
+                               VisitDataFunc visit, int* count);
+
+/**
+ * @brief Prompt for two owners and an operation and print the result.
+ * @param reg pointer to the Registry
+ * Why we made it: Trade planning from the main menu.
+ */
+void compareMenu(Registry* reg);
+
+/* ------------------------------------------------------------
+   24) Node Footprint
+   ------------------------------------------------------------ */
+
+/**
+ * @brief Bytes of count Pokemon as pointer nodes with their own PokemonData.
+ * @param count number of Pokemon
+ * @return bytes, allocator headers not counted
+ * Why we made it: Tree health shows what the mutable Pokedex costs.
+ */
+size_t pointerNodeBytes(int count);
+
+/**
+ * @brief Bytes of a frozen copy's CompactNode pool.
+ * @param frozen pointer or NULL
+ * @return bytes of the record and pool, 0 for NULL
+ * Why we made it: Tree health shows what freezing adds next to the tree.
+ */
+size_t frozenPoolBytes(const FrozenPokedex* frozen);
+
+/* ------------------------------------------------------------
+   25) Session Replay Benchmark
+   ------------------------------------------------------------ */
+
+// A replay script is a list of input.txt-style phases. Every phase is a
+// full mainMenu session ending with 7 (Exit), all run on one registry,
+// so the time of each mainMenu call is the time of that phase.
+
+#define REPLAY_MAX_PHASES 12
+#define REPLAY_NAME 16
+
+typedef struct ReplayPhase {
+    char name[REPLAY_NAME];
+    char* text;              // Input lines of the session
+    size_t length;
+    size_t capacity;
+    int commands;            // Menu choices, exits not counted, -1 if unknown
+    int lines;               // Input lines, exits included
+} ReplayPhase;
+
+typedef struct ReplayScript {
+    ReplayPhase phases[REPLAY_MAX_PHASES];
+    int count;
+} ReplayScript;
+
+/**
+ * @brief Generate create, add, display, fight, release, merge, sort and delete phases.
+ * @param script script to fill, freed with freeReplayScript
+ * @param owners number of owners to open, at least 2
+ * @param adds add commands per owner
+ * @param seed random seed, same seed gives the same script
+ * @return 1 on success, 0 on bad arguments
+ * Why we made it: The generator tracks every Pokedex so each prompt gets the
+ *                 input it expects and the script never falls out of step.
+ */
+int generateReplayScript(ReplayScript* script, int owners, int adds, unsigned int seed);
+
+/**
+ * @brief Load a recorded session as a single phase.
+ * @param path script file, it should end with 7 (Exit) like input.txt
+ * @param script script to fill, only its lines are counted, not its commands
+ * @return 1 on success, 0 if the file cannot be read
+ * Why we made it: Replay real sessions next to generated ones.
+ */
+int loadReplayScript(const char* path, ReplayScript* script);
+
+/**
+ * @brief Save all phases as one session that can be fed to ./ex6 directly.
+ * @param script script to save
+ * @param path output file
+ * @return 1 on success, 0 on IO error
+ * Why we made it: Keep a generated workload to replay it later or by hand.
+ */
+int saveReplayScript(const ReplayScript* script, const char* path);
+
+/**
+ * @brief Free the text of every phase.
+ * @param script script to free
+ * Why we made it: Phase texts grow on the heap while a script is built.
+ */
+void freeReplayScript(ReplayScript* script);
+
+/**
+ * @brief Run every phase through mainMenu with stdout sent to /dev/null.
+ * @param reg registry shared by all phases
+ * @param script phases to run
+ * @param report where per-phase time and commands per second go
+ * @return 0 on success, 1 if stdin or stdout could not be redirected
+ * Why we made it: Microbenchmarks skip readIntSafe, getDynamicInput and menu
+ *                 printing, this measures the whole path a user goes through.
+ */
+int runReplayScript(Registry* reg, const ReplayScript* script, FILE* report);
+
+/* ------------------------------------------------------------
+   26) Type Matchups and Best Counters
+   ------------------------------------------------------------ */
+
+// The type chart is a const 15 x 15 table in ex6.c, fixed at compile time:
+// 2 super effective, 0.5 not very effective, 0 no effect, 1 otherwise.
+// A counter is scored like a fight with both sides of the matchup:
+//   1.5 x attack x (our type against theirs)
+// + 1.2 x HP / (their type against ours, no effect counts as 0.25)
+
+#define COUNTER_MAX 10
+#define COUNTER_MIN_RESIST 0.25
+
+typedef struct CounterPick {
+   PokemonData data;
+   double score;
+} CounterPick;
+
+/**
+ * @brief Attack multiplier of one type against another.
+ * @param attacker type of the attacking Pokemon
+ * @param defender type of the defending Pokemon
+ * @return 0, 0.5, 1 or 2
+ * Why we made it: pokemonFight ignores types, a counter pick cannot.
+ */
+double typeEffectiveness(PokemonType attacker, PokemonType defender);
+
+/**
+ * @brief Counter score of one Pokemon against a target species.
+ * @param candidate Pokemon we would send
+ * @param target species we face
+ * @return fight score with both type multipliers applied
+ * Why we made it: One formula for the index, the menu and the server.
+ */
+double counterScore(const PokemonData* candidate, const PokemonData* target);
+
+/**
+ * @brief Take a reference to the owner's counter index, building it if needed.
+ * @param owner pointer to the Owner
+ * @return index to release with releaseCounterIndex, NULL if the Pokedex is empty
+ * Why we made it: Built once on demand, then single writes keep it up to date.
+ */
+CounterIndex* acquireCounterIndex(OwnerNode* owner);
+
+/**
+ * @brief Drop one reference, freeing the index with the last one.
+ * @param index index or NULL
+ * Why we made it: Readers keep a copy alive while the owner moves on to a new one.
+ */
+void releaseCounterIndex(CounterIndex* index);
+
+/**
+ * @brief Best counters against a target, best first, ties by lower ID.
+ * @param index counter index of the roster
+ * @param target species we face
+ * @param picks out: at most k picks
+ * @param k picks wanted, up to COUNTER_MAX
+ * @param scored out: candidates actually scored, may be NULL
+ * @return number of picks
+ * Why we made it: A type group stops as soon as its best remaining fight score
+ *                 times its best multiplier cannot beat the picks so far.
+ */
+int bestCounters(const CounterIndex* index, const PokemonData* target, CounterPick* picks, int k, int* scored);
+
+/**
+ * @brief Menu entry to list the best counters against a species.
+ * @param owner pointer to the Owner
+ * Why we made it: Pick who to send when a challenger shows up.
+ */
+void bestCounterMenu(OwnerNode* owner);
+
+/* ------------------------------------------------------------
+   27) Team Optimizer
+   ------------------------------------------------------------ */
+
+// Candidates are sorted by fight score once, so the best any partial team
+// can still reach is its score plus the next free slots' worth of the list.
+// Branches are teams with a given best member, claimed one at a time by
+// the registry pool's workers, which share the best score found so far.
+// Scores are kept in tenths (15 x attack + 12 x HP) so they compare exactly.
+
+#define TEAM_SIZE 6
+
+typedef struct TeamConstraints {
+   int maxPerType;              // At most this many of one type, 0 is no limit
+   unsigned int coverMask;      // Bit t set: the team needs a Pokemon of type t
+} TeamConstraints;
+
+typedef struct TeamResult {
+   PokemonData members[TEAM_SIZE];
+   int size;
+   double score;                // Sum of 1.5 x Attack + 1.2 x HP
+   long nodes;                  // Partial teams looked at by all workers
+} TeamResult;
+
+/**
+ * @brief Add every type named in a text to a type mask.
+ * @param text type names or numbers separated by spaces, any case (modified)
+ * @param mask in/out: bit t is set for every type t found
+ * @return 1 on success, 0 on an unknown type
+ * Why we made it: The menu and the server both take the types to cover as text.
+ */
+int addCoverTypes(char* text, unsigned int* mask);
+
+/**
+ * @brief Best team of up to TEAM_SIZE from a version, by branch and bound.
+ * @param pool workers to search with, NULL searches on the calling thread
+ * @param snapshot pinned version to pick from
+ * @param constraints type limit and types to cover
+ * @param result out: members best first, ties go to the lower ID
+ * @return OP_OK, OP_EMPTY, or OP_INVALID if no team meets the constraints
+ * Why we made it: Trying every team of six from a full Pokedex is out of reach.
+ */
+OpStatus searchBestTeam(ThreadPool* pool, PersistentNode* snapshot,
+                        const TeamConstraints* constraints, TeamResult* result);
+
+/**
+ * @brief Best team of a named owner, searched on the registry pool.
+ * @param reg pointer to the Registry
+ * @param name owner name
+ * @param constraints type limit and types to cover
+ * @param result out: the team
+ * @return OP_NOT_FOUND for an unknown owner, else as searchBestTeam
+ * Why we made it: The search runs on a pinned version, so no lock is held meanwhile.
+ */
+OpStatus registryBestTeam(Registry* reg, const char* name, const TeamConstraints* constraints, TeamResult* result);
+
+/**
+ * @brief Menu entry to build the best team of the current owner.
+ * @param reg pointer to the Registry (for its worker pool)
+ * @param owner pointer to the Owner
+ * Why we made it: Let trainers ask for their strongest six.
+ */
+void bestTeamMenu(Registry* reg, OwnerNode* owner);
 
 /* ------------------------------------------------------------
-   13) The Main Menu
+   28) The Main Menu
    ------------------------------------------------------------ */
 
 /**
  * @brief The main driver loop for the program (new pokedex, merge, fight, etc.).
+ * @param reg pointer to the Registry
  * Why we made it: Our top-level UI that keeps the user engaged until they exit.
  */
-void mainMenu(void);
+void mainMenu(Registry* reg);
 
 // Array of Pokemon data
 static const PokemonData pokedex[] = {